@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Allocator microbenchmarks.  Each run executes one benchmark, named on
+ * the command line, and prints its time per operation and the peak
+ * resident set of the process.  The binary uses whatever malloc it is
+ * linked or preloaded with; `make bench` runs every benchmark against
+ * glibc, then with LD_PRELOAD=./libcsemalloc.so, then with
+ * LD_PRELOAD=./libcsemalloc-hardened.so to show the cost of the checks.
+ */
+#define SLOTS 4096
+
+static void *slots[SLOTS];
+static volatile uintptr_t sink;
+
+static uint64_t gSeed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_random(void)
+{
+	gSeed ^= gSeed << 13;
+	gSeed ^= gSeed >> 7;
+	gSeed ^= gSeed << 17;
+	return gSeed;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Same-class churn: a malloc/free pair of one small size, with a few
+ * blocks kept live so the free lists are not trivially empty. */
+static long bench_churn(void)
+{
+	const long ops = 20000000;
+	for (long i = 0; i < ops; i++) {
+		int s = i & 15;
+		free(slots[s]);
+		slots[s] = malloc(64);
+		sink += (uintptr_t)slots[s];
+	}
+	return ops;
+}
+
+/* Mixed-size churn: random sizes from 8 bytes to 8 KB replace random
+ * entries of a table of live blocks. */
+static long bench_mixed(void)
+{
+	const long ops = 5000000;
+	for (long i = 0; i < ops; i++) {
+		uint64_t r = next_random();
+		int s = r % SLOTS;
+		size_t size = 8 + (r >> 20) % ((r >> 40) & 1 ? 8192 : 512);
+		free(slots[s]);
+		slots[s] = malloc(size);
+		*(char *)slots[s] = 1;
+	}
+	return ops;
+}
+
+/* Realloc growth: buffers grown in small steps to 1 MB, the pattern of
+ * string builders and vectors. */
+static long bench_realloc(void)
+{
+	long ops = 0;
+	for (int round = 0; round < 200; round++) {
+		char *buf = NULL;
+		for (size_t size = 16; size <= (1 << 20); size += size / 16 + 16) {
+			buf = realloc(buf, size);
+			buf[size - 1] = 1;
+			ops++;
+		}
+		free(buf);
+	}
+	return ops;
+}
+
+/* Large calloc: cleared blocks of 1 to 16 MB of which only one page is
+ * touched. */
+static long bench_calloc(void)
+{
+	const long ops = 20000;
+	for (long i = 0; i < ops; i++) {
+		size_t size = (1 + next_random() % 16) << 20;
+		char *p = calloc(1, size);
+		sink += p[size / 2];
+		free(p);
+	}
+	return ops;
+}
+
+/* Bulk churn: blocks of 16 KB to 1 MB allocated, written once per page
+ * and freed. */
+static long bench_bulk(void)
+{
+	const long ops = 200000;
+	for (long i = 0; i < ops; i++) {
+		int s = i & 7;
+		free(slots[s]);
+		size_t size = (size_t)16384 << (next_random() % 7);
+		char *p = malloc(size);
+		for (size_t off = 0; off < size; off += 4096)
+			p[off] = 1;
+		slots[s] = p;
+	}
+	return ops;
+}
+
+static const struct {
+	const char *name;
+	long (*run)(void);
+} gBenches[] = {
+	{ "churn", bench_churn },
+	{ "mixed", bench_mixed },
+	{ "realloc", bench_realloc },
+	{ "calloc", bench_calloc },
+	{ "bulk", bench_bulk },
+};
+
+int main(int argc, char *argv[])
+{
+	const char *label = getenv("BENCH_LABEL");
+	struct rusage ru;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s churn|mixed|realloc|calloc|bulk\n", argv[0]);
+		return 2;
+	}
+	for (size_t i = 0; i < sizeof(gBenches) / sizeof(gBenches[0]); i++) {
+		if (strcmp(argv[1], gBenches[i].name) != 0)
+			continue;
+		double start = now_ns();
+		long ops = gBenches[i].run();
+		double elapsed = now_ns() - start;
+		getrusage(RUSAGE_SELF, &ru);
+		printf("%-12s %-8s %10.1f ns/op %10ld KB peak RSS\n", label ? label : "",
+			   gBenches[i].name, elapsed / ops, ru.ru_maxrss);
+		return 0;
+	}
+	fprintf(stderr, "unknown benchmark %s\n", argv[1]);
+	return 2;
+}
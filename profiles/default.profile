@@ -0,0 +1,8 @@
+# The default size-class geometry: 4 KB chunks, classes 8 bytes apart up
+# to 64 and four per doubling after that, pool blocks up to 4 KB.
+CHUNK_SHIFT 12
+MIN_CLASS 16
+LINEAR_MAX 64
+SPACING 4
+MAX_CLASS 4096
+MAX_CHUNKS 8
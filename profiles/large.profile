@@ -0,0 +1,9 @@
+# For programs that allocate many medium-sized buffers: 16 KB chunks and
+# pool blocks up to 32 KB, so that buffers of a few pages are carved
+# from superblocks instead of each being mapped on its own.
+CHUNK_SHIFT 14
+MIN_CLASS 16
+LINEAR_MAX 64
+SPACING 4
+MAX_CLASS 32768
+MAX_CHUNKS 8
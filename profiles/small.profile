@@ -0,0 +1,9 @@
+# For programs dominated by small objects: classes 8 bytes apart up to
+# 128 and eight per doubling after that, so that small requests waste
+# little, with pool blocks only up to 1 KB.
+CHUNK_SHIFT 12
+MIN_CLASS 16
+LINEAR_MAX 128
+SPACING 8
+MAX_CLASS 1024
+MAX_CHUNKS 8
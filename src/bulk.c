@@ -1,23 +1,449 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/mman.h>
 
+#include "mm.h"
+
+/*
+ * Freed mappings are kept in a cache instead of being unmapped, so that
+ * programs which repeatedly allocate and free buffers of the same size
+ * reuse them without a system call.  Mappings are bucketed by the log2
+ * of their page count, and a bucket is searched for one of the exact
+ * page count asked for.  Allocations of up to a megabyte come from the
+ * pools, so the cache mostly holds a few large mappings, and any mapping
+ * no larger than the cache itself may be kept.
+ * The bookkeeping for a cached mapping lives in its own first bytes,
+ * after the allocator's header word, which is left as it was freed.
+ *
+ * The cache holds at most MM_BULK_CACHE_BYTES bytes (default
+ * BULK_CACHE_BYTES) and a mapping that stays unused for longer than
+ * MM_BULK_CACHE_MS milliseconds (default BULK_CACHE_MS) is unmapped on
+ * the next call into this file.  MM_BULK_CACHE_BYTES=0 disables it.
+ */
+#define BULK_CACHE_BINS 64
+#define BULK_CACHE_BYTES (32UL << 20)
+#define BULK_CACHE_MS 1000
+
+typedef struct BulkCached {
+    size_t header;
+    struct BulkCached *next;   /* same bucket */
+    struct BulkCached *prev;
+    struct BulkCached *newer;  /* every cached mapping, by age */
+    struct BulkCached *older;
+    size_t pages;
+    uint64_t freed;
+} BulkCached;
+
+static pthread_mutex_t gBulkLock = PTHREAD_MUTEX_INITIALIZER;
+static BulkCached *gBulkBins[BULK_CACHE_BINS];
+static BulkCached *gBulkNewest;
+static BulkCached *gBulkOldest;
+static size_t gBulkCached;
+static size_t gBulkCap;
+static uint64_t gBulkAge;
+static size_t gPageSize;
+
+/* System calls made here, for mm_stats(). */
+static struct {
+    size_t mmap;
+    size_t munmap;
+    size_t mremap;
+    size_t madvise;
+} gBulkCalls;
+
+#define COUNT_CALL(field) __atomic_fetch_add(&gBulkCalls.field, 1, __ATOMIC_RELAXED)
+
+/*
+ * Mappings of at least MM_HUGEPAGE_THRESHOLD bytes are rounded up to a
+ * multiple of HUGE_PAGE_SIZE and backed by huge pages: MAP_HUGETLB is
+ * tried first, and once the hugetlbfs pool turns out to be empty, the
+ * mapping is aligned to HUGE_PAGE_SIZE and advised with MADV_HUGEPAGE.
+ * The length of such a mapping follows from its size alone, so
+ * bulk_free() can unmap it whole without recording how it was made.
+ * Huge mappings bypass the cache above.
+ */
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/* Defined in numa.c: binds fresh memory to the calling thread's NUMA
+ * node, so that it is placed there whichever thread touches it first. */
+extern void numa_bind_local(void *addr, size_t len);
+
+static size_t gHugeThreshold;
+static int gHugetlbFailed;
+static struct mm_huge_stats gHugeStats;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Reads the configuration on first use.  Called with gBulkLock held. */
+static void bulk_cache_init(void) {
+    const char *env;
+
+    if (gPageSize != 0) {
+        return;
+    }
+    gBulkCap = BULK_CACHE_BYTES;
+    gBulkAge = BULK_CACHE_MS;
+    if ((env = getenv("MM_BULK_CACHE_BYTES")) != NULL) {
+        gBulkCap = strtoul(env, NULL, 0);
+    }
+    if ((env = getenv("MM_BULK_CACHE_MS")) != NULL) {
+        gBulkAge = strtoul(env, NULL, 0);
+    }
+    if ((env = getenv("MM_HUGEPAGE_THRESHOLD")) != NULL) {
+        gHugeThreshold = strtoul(env, NULL, 0);
+    }
+    gPageSize = sysconf(_SC_PAGESIZE);
+}
+
+static int bulk_cache_bin(size_t pages) {
+    return 63 - __builtin_clzl(pages);
+}
+
+static void bulk_cache_unlink(BulkCached *entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        gBulkBins[bulk_cache_bin(entry->pages)] = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    }
+    if (entry->newer != NULL) {
+        entry->newer->older = entry->older;
+    } else {
+        gBulkNewest = entry->older;
+    }
+    if (entry->older != NULL) {
+        entry->older->newer = entry->newer;
+    } else {
+        gBulkOldest = entry->newer;
+    }
+    gBulkCached -= entry->pages * gPageSize;
+}
+
+/*
+ * Unmaps the oldest cached mappings until the cache has room for extra
+ * more bytes and holds nothing older than the age limit.  Called with
+ * gBulkLock held.
+ */
+static void bulk_cache_evict(size_t extra) {
+    uint64_t now = now_ms();
+
+    while (gBulkOldest != NULL &&
+           (gBulkCached + extra > gBulkCap || now - gBulkOldest->freed > gBulkAge)) {
+        BulkCached *entry = gBulkOldest;
+        bulk_cache_unlink(entry);
+        munmap(entry, entry->pages * gPageSize);
+        COUNT_CALL(munmap);
+    }
+}
+
+static int bulk_huge(size_t size) {
+    return gHugeThreshold != 0 && size >= gHugeThreshold;
+}
+
+static size_t huge_length(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+/*
+ * Asks for transparent huge pages on a mapping that is already aligned
+ * to HUGE_PAGE_SIZE, and accounts for the outcome.
+ */
+static void huge_advise(void *ptr, size_t length) {
+    __atomic_fetch_add(&gHugeStats.requested_bytes, length, __ATOMIC_RELAXED);
+#ifdef MADV_HUGEPAGE
+    COUNT_CALL(madvise);
+    if (madvise(ptr, length, MADV_HUGEPAGE) == 0) {
+        __atomic_fetch_add(&gHugeStats.advised_bytes, length, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
+    __atomic_fetch_add(&gHugeStats.fallback_bytes, length, __ATOMIC_RELAXED);
+}
+
+static void *huge_alloc(size_t size) {
+    size_t length = huge_length(size);
+
+#ifdef MAP_HUGETLB
+    if (!__atomic_load_n(&gHugetlbFailed, __ATOMIC_RELAXED)) {
+        void *mapping = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        COUNT_CALL(mmap);
+        if (mapping != MAP_FAILED) {
+            numa_bind_local(mapping, length);
+            __atomic_fetch_add(&gHugeStats.requested_bytes, length, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&gHugeStats.hugetlb_bytes, length, __ATOMIC_RELAXED);
+            return mapping;
+        }
+        __atomic_store_n(&gHugetlbFailed, 1, __ATOMIC_RELAXED);
+    }
+#endif
+    char *map = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    COUNT_CALL(mmap);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    char *base = (char *)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (base > map) {
+        munmap(map, base - map);
+        COUNT_CALL(munmap);
+    }
+    munmap(base + length, map + HUGE_PAGE_SIZE - base);
+    COUNT_CALL(munmap);
+    numa_bind_local(base, length);
+    huge_advise(base, length);
+    return base;
+}
+
+/*
+ * Applies the huge page policy to a mapping the allocator made itself
+ * (a pool superblock).  ptr must be aligned to HUGE_PAGE_SIZE.
+ */
+void bulk_advise_huge(void *ptr, size_t size) {
+    pthread_mutex_lock(&gBulkLock);
+    bulk_cache_init();
+    pthread_mutex_unlock(&gBulkLock);
+    if (bulk_huge(size)) {
+        huge_advise(ptr, size);
+    }
+}
+
+/* Maps size bytes, reusing a cached mapping if there is one.  A reused
+ * mapping is cleared if zero is set. */
+static void *bulk_map(size_t size, int zero) {
+    pthread_mutex_lock(&gBulkLock);
+    bulk_cache_init();
+    pthread_mutex_unlock(&gBulkLock);
+    if (bulk_huge(size)) {
+        return huge_alloc(size);
+    }
+
+    pthread_mutex_lock(&gBulkLock);
+    size_t pages = (size + gPageSize - 1) / gPageSize;
+    BulkCached *entry = NULL;
+    if (gBulkOldest != NULL) {
+        bulk_cache_evict(0);
+        entry = gBulkBins[bulk_cache_bin(pages)];
+        while (entry != NULL && entry->pages != pages) {
+            entry = entry->next;
+        }
+        if (entry != NULL) {
+            bulk_cache_unlink(entry);
+        }
+    }
+    pthread_mutex_unlock(&gBulkLock);
+    if (entry != NULL) {
+        if (zero) {
+            memset(entry, 0, size);
+        }
+        return entry;
+    }
 
-void *bulk_alloc(size_t size) {
     void *mapping =  mmap(NULL, size, PROT_READ | PROT_WRITE,
                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    COUNT_CALL(mmap);
 
     if (mapping == MAP_FAILED) {
         return NULL;
     } else {
+        numa_bind_local(mapping, size);
         return mapping;
     }
 }
 
+/*
+ * Unmaps the cached mappings that have outlived the age limit, or all of
+ * them if all is set.  Returns the number of bytes unmapped.
+ */
+size_t bulk_trim(int all) {
+    pthread_mutex_lock(&gBulkLock);
+    bulk_cache_init();
+    size_t before = gBulkCached;
+    if (all) {
+        while (gBulkOldest != NULL) {
+            BulkCached *entry = gBulkOldest;
+            bulk_cache_unlink(entry);
+            munmap(entry, entry->pages * gPageSize);
+            COUNT_CALL(munmap);
+        }
+    } else {
+        bulk_cache_evict(0);
+    }
+    size_t released = before - gBulkCached;
+    pthread_mutex_unlock(&gBulkLock);
+    return released;
+}
+
+void *bulk_alloc(size_t size) {
+    return bulk_map(size, 0);
+}
+
+void *bulk_calloc(size_t size) {
+    return bulk_map(size, 1);
+}
+
 void bulk_free(void *ptr, size_t size) {
+    pthread_mutex_lock(&gBulkLock);
+    bulk_cache_init();
+    if (bulk_huge(size)) {
+        pthread_mutex_unlock(&gBulkLock);
+        size = huge_length(size);
+        goto unmap;
+    }
+    size_t pages = (size + gPageSize - 1) / gPageSize;
+    if (pages * gPageSize <= gBulkCap) {
+        bulk_cache_evict(pages * gPageSize);
+        BulkCached *entry = ptr;
+        BulkCached **bin = &gBulkBins[bulk_cache_bin(pages)];
+        entry->pages = pages;
+        entry->freed = now_ms();
+        entry->prev = NULL;
+        entry->next = *bin;
+        if (entry->next != NULL) {
+            entry->next->prev = entry;
+        }
+        *bin = entry;
+        entry->older = gBulkNewest;
+        entry->newer = NULL;
+        if (gBulkNewest != NULL) {
+            gBulkNewest->newer = entry;
+        } else {
+            gBulkOldest = entry;
+        }
+        gBulkNewest = entry;
+        gBulkCached += pages * gPageSize;
+        pthread_mutex_unlock(&gBulkLock);
+        return;
+    }
+    pthread_mutex_unlock(&gBulkLock);
+
+unmap:
+    COUNT_CALL(munmap);
     if (munmap(ptr, size)) {
         fprintf(stderr, "munmap failed in bulk_free(); you probably passed invalid arguments\n");
     }
 }
+
+void *bulk_realloc(void *ptr, size_t old_size, size_t new_size) {
+    pthread_mutex_lock(&gBulkLock);
+    bulk_cache_init();
+    pthread_mutex_unlock(&gBulkLock);
+    int was_huge = bulk_huge(old_size);
+    int is_huge = bulk_huge(new_size);
+
+    if (was_huge && is_huge) {
+        size_t old_length = huge_length(old_size);
+        size_t new_length = huge_length(new_size);
+        if (old_length == new_length) {
+            return ptr;
+        }
+        /* A mapping moved by mremap() may land off a HUGE_PAGE_SIZE
+         * boundary and lose its huge pages, and its new length would go
+         * unaccounted, so huge mappings are only shrunk in place. */
+        if (new_length < old_length) {
+            COUNT_CALL(mremap);
+            if (mremap(ptr, old_length, new_length, 0) != MAP_FAILED) {
+                return ptr;
+            }
+        }
+    } else if (!was_huge && !is_huge) {
+        void *mapping = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+        COUNT_CALL(mremap);
+        if (mapping != MAP_FAILED) {
+            return mapping;
+        }
+        return NULL;
+    }
+
+    /* Crossing the threshold changes how the mapping must be made, and a
+     * growing huge mapping is made afresh by huge_alloc(): copy. */
+    void *mapping = bulk_alloc(new_size);
+    if (mapping == NULL) {
+        return NULL;
+    }
+    memcpy(mapping, ptr, old_size < new_size ? old_size : new_size);
+    bulk_free(ptr, old_size);
+    return mapping;
+}
+
+/*
+ * Fork handlers, run from the allocator's own: the cache lock must not
+ * be held by another thread while the child's copy of it is in use.
+ */
+void bulk_fork_prepare(void) {
+    pthread_mutex_lock(&gBulkLock);
+}
+
+void bulk_fork_parent(void) {
+    pthread_mutex_unlock(&gBulkLock);
+}
+
+void bulk_fork_child(void) {
+    pthread_mutex_init(&gBulkLock, NULL);
+}
+
+/* Adds the value of field, in kB, from the text of smaps_rollup to
+ * *bytes. */
+static void smaps_field(const char *text, const char *field, size_t *bytes) {
+    size_t len = strlen(field);
+
+    for (const char *line = text; line != NULL && *line != '\0'; ) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            *bytes += strtoul(line + len + 1, NULL, 10) * 1024;
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+}
+
+int mm_huge_stats(struct mm_huge_stats *stats) {
+    char text[4096];
+    ssize_t n = 0;
+    int fd;
+
+    stats->requested_bytes = __atomic_load_n(&gHugeStats.requested_bytes, __ATOMIC_RELAXED);
+    stats->hugetlb_bytes = __atomic_load_n(&gHugeStats.hugetlb_bytes, __ATOMIC_RELAXED);
+    stats->advised_bytes = __atomic_load_n(&gHugeStats.advised_bytes, __ATOMIC_RELAXED);
+    stats->fallback_bytes = __atomic_load_n(&gHugeStats.fallback_bytes, __ATOMIC_RELAXED);
+    stats->anon_huge_resident = 0;
+    stats->hugetlb_resident = 0;
+
+    if ((fd = open("/proc/self/smaps_rollup", O_RDONLY)) < 0) {
+        return -1;
+    }
+    n = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    text[n] = '\0';
+    smaps_field(text, "AnonHugePages", &stats->anon_huge_resident);
+    smaps_field(text, "Shared_Hugetlb", &stats->hugetlb_resident);
+    smaps_field(text, "Private_Hugetlb", &stats->hugetlb_resident);
+    return 0;
+}
+
+/* Adds the counters kept here to stats. */
+void bulk_stats(struct mm_stats *stats) {
+    stats->bulk_cached_bytes += __atomic_load_n(&gBulkCached, __ATOMIC_RELAXED);
+    stats->mmap_calls += __atomic_load_n(&gBulkCalls.mmap, __ATOMIC_RELAXED);
+    stats->munmap_calls += __atomic_load_n(&gBulkCalls.munmap, __ATOMIC_RELAXED);
+    stats->mremap_calls += __atomic_load_n(&gBulkCalls.mremap, __ATOMIC_RELAXED);
+    stats->madvise_calls += __atomic_load_n(&gBulkCalls.madvise, __ATOMIC_RELAXED);
+}
@@ -1,25 +1,334 @@
+#define _GNU_SOURCE
+
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#ifdef MM_HARDENED
+#include <sys/auxv.h>
+#endif
+
+#include "mm.h"
+#include "size_classes.h"
+
+/* Pool blocks are carved from runs of CHUNK_SIZE chunks.  Every run
+ * holds blocks of a single size class; the chunk size, the class sizes
+ * and run lengths, and SIZE_CLASS_MAX, the largest pool block, come from
+ * size_classes.h, which the build generates from a profile in
+ * profiles/. */
+#define CHUNK_SIZE (1<<CHUNK_SHIFT)
+
+/* By default every pool block starts with a size_t header holding its
+ * size and allocation flag.  Building with -DMM_HEADERLESS drops that
+ * header: the class of a block is then read from its chunk descriptor,
+ * found through the page map, and small blocks carry no overhead. */
+#ifdef MM_HEADERLESS
+#define BLOCK_HEADER 0
+#else
+#define BLOCK_HEADER sizeof(size_t)
+#endif
 
-/* When requesting memory from the OS using sbrk(), request it in
-* increments of CHUNK_SIZE. */
-#define CHUNK_SIZE (1<<12)
+/* Building with -DMM_HARDENED (libcsemalloc-hardened.so) adds cheap
+ * corruption checks that abort with a message:
+ *
+ *  - the top HEADER_CANARY_BITS bits of every header hold a canary
+ *    derived from the header's address and a per-process secret, checked
+ *    on free() and realloc();
+ *  - free-list links are stored xor-ed with the secret and their own
+ *    address, and a decoded link must point into the pool;
+ *  - freeing a block that is already free aborts instead of being
+ *    ignored;
+ *  - free() checks the class in the header against the class of the
+ *    run the block lies in, and that the pointer is a block boundary.
+ *
+ * Without it, HARDEN_CHECK() and the link macros compile to the plain
+ * code. */
+#ifdef MM_HARDENED
+#ifdef MM_HEADERLESS
+#error "MM_HARDENED needs block headers"
+#endif
+#define HEADER_CANARY_BITS 16
+#define HEADER_SIZE_MASK \
+	(~(size_t)0x7 & (((size_t)1 << (64 - HEADER_CANARY_BITS)) - 1))
+#define HARDEN_CHECK(cond, what, ptr)									\
+	do {																\
+		if (__builtin_expect(!(cond), 0))								\
+			harden_fail((what), (ptr));									\
+	} while (0)
+static void harden_fail(const char *what, void *ptr) __attribute__((noreturn, cold));
+#else
+#define HEADER_SIZE_MASK (~(size_t)0x7)
+#define HARDEN_CHECK(cond, what, ptr) do { } while (0)
+#endif
 
 typedef struct MemNode {
+#ifndef MM_HEADERLESS
 	size_t header;
+#endif
 	char data[0];
     struct MemNode *next;
-    struct MemNode *prev;
 } MemNode;
 
+/* Bulk allocations always carry a header, in both modes. */
+typedef struct BulkNode {
+	size_t header;
+	char data[0];
+} BulkNode;
+
+/* Per-chunk metadata, kept in the superblock header.  The descriptor of
+ * the first chunk of a run describes the whole run, chunks long; the
+ * others only record the run's index and their offset from the first.
+ * free links the run's blocks that are back on the arena side; blocks
+ * past carved have never been handed out.  Runs with free or uncarved
+ * blocks are linked on their arena's chunkList for the class.  A free
+ * run has index CHUNK_FREE in its first and last descriptors, the last
+ * one's offset leading back to the first, and is linked on one of the
+ * arena's freeRuns lists instead.  A run holding the slab of an object
+ * cache has index CHUNK_CACHE, a block of a region CHUNK_REGION and a
+ * mid-size allocation CHUNK_MID.  zero is set while the memory of a free
+ * run, or of the uncarved blocks of a slab, is known to hold zeros, and
+ * freed is the time, in decay_clock() milliseconds, a free run was
+ * last put on its list. */
+typedef struct ChunkDesc {
+	MemNode *free;
+	struct ChunkDesc *next;
+	struct ChunkDesc *prev;
+	unsigned short live;
+	unsigned short carved;
+	unsigned char index;
+	unsigned char listed;
+	unsigned char zero;
+	unsigned short offset;
+	unsigned short chunks;
+	unsigned int freed;
+} ChunkDesc;
+
+#define CHUNK_FREE 0xff
+#define CHUNK_HEADER 0xfe
+#define CHUNK_CACHE 0xfd
+#define CHUNK_REGION 0xfc
+#define CHUNK_MID 0xfb
+
 typedef struct MemList {
-	MemNode *chunkList[8];
+	ChunkDesc *chunkList[NCLASSES];
 } MemList;
 
+/* Chunks are carved from superblocks: SUPERBLOCK_SIZE mappings aligned
+ * to their own size, so the superblock of any pool block is found by
+ * masking its address.  The first SUPERBLOCK_HEADER bytes hold the
+ * superblock header and the chunk descriptors.
+ *
+ * The rest is divided into runs of any number of chunks.  Free runs are
+ * kept on segregated lists: one per length up to RUN_EXACT chunks, and
+ * four per doubling above, with a bitmap of the lists that are not
+ * empty.  A run is allocated from the first list whose runs can hold it,
+ * splitting off the remainder; a freed run is merged with the free runs
+ * before and after it, found through the boundary tags in the chunk
+ * descriptors, so memory freed by one class can be carved for any
+ * other and adjacent free space never stays split.  used counts the
+ * chunks in runs handed out, and idle records when it last dropped to
+ * zero, when the whole superblock is one free run again.
+ *
+ * Free memory is handed back to the OS once it has stayed unused for
+ * MM_DECAY_MS milliseconds (default DECAY_MS), so that a load spike does
+ * not leave its high-water mark resident, but memory that is reused
+ * soon is not released and faulted back in over and over: free runs are
+ * purged with madvise(MADV_DONTNEED), after which they read back as
+ * zeros, and empty superblocks are unmapped, except for the arena's last
+ * one.  The arena looks for such memory whenever a thread refills or
+ * flushes its cache, at most every quarter interval, so the work is
+ * spread over the allocation calls; with MM_DECAY_THREAD=1 a background
+ * thread does the same while the program is idle.  MM_DECAY_MS=0 turns
+ * decay off: empty superblocks are then released as soon as they empty,
+ * and free runs stay resident until mm_trim() is called. */
+#define SUPERBLOCK_SHIFT 21
+#define SUPERBLOCK_SIZE (1 << SUPERBLOCK_SHIFT)
+#define SUPERBLOCK_MASK (~((uintptr_t)SUPERBLOCK_SIZE - 1))
+#define SUPERBLOCK_CHUNKS (SUPERBLOCK_SIZE / CHUNK_SIZE)
+/* Free run lists: lengths 1 to RUN_EXACT each have their own; past that,
+ * every doubling of the length is split into four lists by the two bits
+ * after the leading one (see run_bin()), not one list per power of two.
+ * With 4 KB chunks, the 512 of a superblock need 40 of the RUN_BINS. */
+#define RUN_EXACT 16
+#define RUN_BINS 64
+#define DECAY_MS 1000
+
+/* Allocations too large for the size classes but no larger than MID_MAX
+ * bytes with their header are mid-size: runs of whole chunks taken from
+ * the arena's free runs, instead of mappings of their own.  They carry
+ * the same header as bulk blocks, so the code that reads sizes and flags
+ * treats both alike, and the size in the header tells them apart.  A
+ * mid-size run is freed to the arena that owns it, under its lock when
+ * that is the thread's own arena and on its remote list otherwise, and
+ * is resized in place by growing into the free run after it or giving
+ * back its tail. */
+#define MID_MAX (1 << 20)
+
+struct Arena;
+
+typedef struct Superblock {
+	struct Arena *arena;
+	struct Superblock *next;
+	struct Superblock *prev;
+	size_t used;
+	unsigned int idle;
+	ChunkDesc chunks[SUPERBLOCK_CHUNKS];
+} Superblock;
+
+#define SUPERBLOCK_HEADER \
+	((sizeof(Superblock) + CHUNK_SIZE - 1) / CHUNK_SIZE * CHUNK_SIZE)
+
+/* The page map records which superblock, if any, covers an address, so
+ * that free() can tell pool blocks from bulk blocks without reading a
+ * header.  It is a two-level radix tree over address >> SUPERBLOCK_SHIFT
+ * for 48-bit addresses; leaves are mapped on first use. */
+#define PAGEMAP_BITS (48 - SUPERBLOCK_SHIFT)
+#define PAGEMAP_LEAF_BITS 14
+#define PAGEMAP_ROOT_BITS (PAGEMAP_BITS - PAGEMAP_LEAF_BITS)
+
+/* The shared pools are split into arenas, each with its own lists and
+ * its own superblocks, so threads assigned to different arenas never
+ * contend.  The arena count is read from MM_ARENAS at first use and
+ * defaults to the number of online CPUs; MM_ARENA_POLICY=cpu assigns
+ * threads by the CPU they first allocate on instead of round-robin.
+ *
+ * A pool block or mid-size run freed by a thread of another arena is not
+ * put in that thread's cache: it is pushed onto its own arena's remote
+ * list with a single compare-and-swap, and the arena takes the whole list
+ * back the next time one of its threads refills or takes a mid-size run
+ * under the lock.  A thread that frees what another allocated thus never
+ * takes the other's lock.
+ *
+ * On a machine with several NUMA nodes the arenas are divided evenly
+ * between the nodes, each node getting at least one, and a thread is
+ * assigned among the arenas of the node of the CPU it first allocates
+ * on.  Superblocks are bound to their arena's node before they are
+ * touched, so the pages of an arena stay on its node even when threads
+ * of other nodes free into them. */
+#define MAX_ARENAS 64
+
+typedef struct Arena {
+	pthread_mutex_t lock;
+	MemNode *remote;
+	MemList pools;
+	ChunkDesc *freeRuns[RUN_BINS];
+	uint64_t runBins;
+	Superblock *superblocks;
+	size_t blocks[NCLASSES];
+	unsigned int decayNext;
+	int node;
+} Arena;
+
+/* Each thread keeps a small stack of free blocks per size class in
+ * front of its arena.  The common malloc()/free() path only touches
+ * this cache; it is refilled from and flushed to the arena lists in
+ * batches of TCACHE_BATCH blocks, under the arena lock. */
+#define TCACHE_BATCH 16
+#define TCACHE_MAX 64
+
+/*
+ * Allocation counters.  Each thread counts into a ThreadStats of its own,
+ * so the hot paths never write a cache line another thread writes;
+ * mm_stats() sums them all.  The records are never freed: a thread that
+ * exits leaves its record to the next new thread, which keeps adding to
+ * it, so the totals stay cumulative and readers can walk the list
+ * without locks.  Counts made while no record is attached (during
+ * thread teardown) go to gStatsShared with atomic adds.
+ */
+#if NCLASSES > MM_STATS_CLASSES
+#error "struct mm_stats has too few class slots"
+#endif
+
+/* A thread's magazine for one object cache: a stack of up to MAG_SIZE
+ * free objects, tagged with the generation of the cache it belongs to,
+ * and the thread's counts for that cache. */
+#define MAX_CACHES 256
+#define MAG_SIZE 32
+
+typedef struct Magazine {
+	unsigned int gen;
+	unsigned int count;
+	size_t allocs;
+	size_t frees;
+	void *objs[MAG_SIZE];
+} Magazine;
+
+typedef struct ThreadStats {
+	struct ThreadStats *next;
+	int inUse;
+	size_t allocs[NCLASSES];
+	size_t frees[NCLASSES];
+	size_t requested;
+	size_t midAllocs;
+	size_t midFrees;
+	size_t midBytes;
+	size_t midFreedBytes;
+	size_t bulkAllocs;
+	size_t bulkFrees;
+	size_t bulkBytes;
+	size_t bulkFreedBytes;
+	Magazine *mags;
+} ThreadStats;
+
+typedef struct TCache {
+	MemNode *bins[NCLASSES];
+	unsigned int count[NCLASSES];
+	ThreadStats *stats;
+} TCache;
+
+#define STATS_ADD(tc, field, n)												\
+	do {																	\
+		if ((tc) != NULL && (tc)->stats != NULL)							\
+			(tc)->stats->field += (n);										\
+		else																\
+			__atomic_fetch_add(&gStatsShared.field, (n), __ATOMIC_RELAXED);	\
+	} while (0)
+
+enum { TCACHE_UNINIT = 0, TCACHE_ACTIVE, TCACHE_DEAD };
+
 int printFlag = 0;
 #define my_print(fmt, args...) if (printFlag) fprintf(stderr, "File Name:%s, Func Name:%s, Line:%d " fmt,__FILE__, __FUNCTION__, __LINE__, ##args);
-static MemList *gMemDataTable = NULL;
+static Arena gArenas[MAX_ARENAS];
+static unsigned int gArenaCount;
+static unsigned int gArenaNext[MAX_ARENAS];
+static unsigned int gNodeCount;
+static unsigned int gNodeArenas;
+static int gArenaByCpu;
+static pthread_once_t gArenaOnce = PTHREAD_ONCE_INIT;
+static unsigned int gDecayMs;
+static int gDecayThread;
+
+static Superblock **gPageMap[1 << PAGEMAP_ROOT_BITS];
+
+static __thread Arena *gThreadArena __attribute__((tls_model("initial-exec")));
+
+static __thread TCache gTCache __attribute__((tls_model("initial-exec")));
+static __thread int gTCacheState __attribute__((tls_model("initial-exec")));
+/* Bytes the thread may still allocate before the next profile sample. */
+static __thread long gProfBytes __attribute__((tls_model("initial-exec")));
+static pthread_key_t gTCacheKey;
+static pthread_once_t gTCacheOnce = PTHREAD_ONCE_INIT;
+
+static ThreadStats *gStatsList;
+static ThreadStats gStatsShared;
+/* System calls made for pool memory, and the superblocks mapped. */
+static struct {
+	size_t mmap;
+	size_t munmap;
+	size_t madvise;
+	size_t superblocks;
+} gPoolCalls;
+
+#define COUNT_CALL(field) __atomic_fetch_add(&gPoolCalls.field, 1, __ATOMIC_RELAXED)
 
 /* The standard allocator interface from stdlib.h.  These are the
  * functions you must implement, more information on each function is
@@ -29,48 +338,86 @@ void *malloc(size_t size);
 void free(void *ptr);
 void *calloc(size_t nmemb, size_t size);
 void *realloc(void *ptr, size_t size);
-void set_chunk_alloc_flag(MemNode *node);
-void set_chunk_free_flag(MemNode *node);
-int get_chunk_free_flag(MemNode *node);
-int get_chunk_size(MemNode *node);
-double _pow(double b, int e);
+int posix_memalign(void **memptr, size_t align, size_t size);
+void *aligned_alloc(size_t align, size_t size);
+void *memalign(size_t align, size_t size);
+void *valloc(size_t size);
+void *pvalloc(size_t size);
+size_t malloc_usable_size(void *ptr);
+void malloc_stats(void);
+int malloc_trim(size_t pad);
+void free_sized(void *ptr, size_t size);
+void free_aligned_sized(void *ptr, size_t align, size_t size);
+void set_chunk_alloc_flag(size_t *header);
+void set_chunk_free_flag(size_t *header);
+int get_chunk_free_flag(size_t *header);
+size_t get_chunk_size(size_t *header);
 size_t alignment(size_t size);
 
-void set_chunk_alloc_flag(MemNode *node)
+void set_chunk_alloc_flag(size_t *header)
 {
-	node->header = node->header |0x00000001;
+	*header = *header |0x00000001;
 }
 
-void set_chunk_free_flag(MemNode *node)
+void set_chunk_free_flag(size_t *header)
 {
-	node->header &= ~0x00000001;
+	*header &= ~0x00000001;
 }
 
 
-int get_chunk_free_flag(MemNode *node) 
+int get_chunk_free_flag(size_t *header)
+{
+	return (!(*header & 0x00000001));
+}
+
+/* Block sizes are multiples of 8, leaving the low three bits for
+ * flags. */
+size_t get_chunk_size(size_t *header)
 {
-	return (!(node->header & 0x00000001));
+	return (*header & HEADER_SIZE_MASK);
 }
 
-int get_chunk_size(MemNode *node)
+/*
+ * When an aligned allocation cannot be served by a naturally aligned
+ * block, it is cut from a larger block and the word before the aligned
+ * pointer records its distance from the block's data, flagged with
+ * CHUNK_ALIGNED.  Ordinary headers never have this bit set.
+ */
+#define CHUNK_ALIGNED 0x2
+
+/* Set in the header of blocks the heap profiler has sampled (bulk
+ * blocks, and pool blocks unless headerless). */
+#define CHUNK_SAMPLED 0x4
+
+#ifdef MM_HARDENED
+static uintptr_t gHardenSecret;
+
+static void harden_fail(const char *what, void *ptr)
 {
-	return (node->header & 0xFFFFFFE0);
+	char buf[128];
+	int n = snprintf(buf, sizeof(buf), "mm: %s at %p\n", what, ptr);
+	write(2, buf, n);
+	abort();
 }
 
-double _pow(double b, int e)
-{
-	double result = 1;
-	for (int i = 0; i < e; i++)
-		result = result * b;
-
-	return result;
+/* The canary of the header at header, in place in the top bits. */
+static inline size_t header_canary(size_t *header)
+{
+	size_t hash = ((uintptr_t)header ^ gHardenSecret) * 0x9e3779b97f4a7c15ULL;
+	return hash & ~(((size_t)1 << (64 - HEADER_CANARY_BITS)) - 1);
 }
 
-size_t alignment(size_t size)
-{
-	if ((size & 0x7) == 0)
-		return size;
-	return ((size >> 3) + 1) << 3;
+#define SET_HEADER(block, size) \
+	((block)->header = (size) | header_canary(&(block)->header))
+#else
+#define SET_HEADER(block, size) ((block)->header = (size))
+#endif
+
+size_t alignment(size_t size)
+{
+	if ((size & 0x7) == 0)
+		return size;
+	return ((size >> 3) + 1) << 3;
 }
 
 
@@ -96,267 +443,2377 @@ extern void *bulk_alloc(size_t size);
 extern void bulk_free(void *ptr, size_t size);
 
 /*
- * This function computes the log base 2 of the allocation block size
- * for a given allocation.  To find the allocation block size from the
- * result of this function, use 1 << block_size(x).
- *
- * Note that its results are NOT meaningful for any
- * size > 4088!
- *
- * You do NOT need to understand how this function works.  If you are
- * curious, see the gcc info page and search for __builtin_clz; it
- * basically counts the number of leading binary zeroes in the value
- * passed as its argument.
+ * Also defined in bulk.c: like bulk_alloc(), but the region is cleared.
+ * Only regions reused from the cache of freed mappings need a memset();
+ * fresh mappings come from the kernel zeroed.
+ */
+extern void *bulk_calloc(size_t size);
+
+/*
+ * Also defined in bulk.c: resizes a region created with bulk_alloc()
+ * from old_size to new_size bytes, moving it if it cannot grow where it
+ * is.  Returns the (possibly new) address of the region, or NULL on
+ * failure, in which case the old region is left untouched.
+ */
+extern void *bulk_realloc(void *ptr, size_t old_size, size_t new_size);
+
+/*
+ * Also defined in bulk.c: applies the huge page policy to a size-byte
+ * mapping made directly with mmap().
+ */
+extern void bulk_advise_huge(void *ptr, size_t size);
+
+/*
+ * The heap profiler, defined in prof.c.  gProfOn is set once sampling
+ * is enabled; prof_interval() returns the bytes to allocate until the
+ * next sample, prof_record() and prof_release() add and drop samples.
+ */
+extern int gProfOn;
+extern long prof_interval(void);
+extern int prof_record(void *ptr, size_t size);
+extern void prof_release(void *ptr);
+extern void prof_fork_prepare(void);
+extern void prof_fork_parent(void);
+extern void prof_fork_child(void);
+
+/*
+ * NUMA topology, defined in numa.c.  Nodes are numbered by index from 0
+ * to numa_nodes() - 1; numa_bind() binds a range of fresh memory to one.
+ */
+extern int numa_nodes(void);
+extern int numa_cpu_node(int cpu);
+extern int numa_node_id(int index);
+extern void numa_bind(void *addr, size_t len, int index);
+
+/* Also defined in bulk.c: unmaps the cached mappings past their age
+ * limit, or all of them, and returns the bytes unmapped. */
+extern size_t bulk_trim(int all);
+
+/* Also defined in bulk.c: adds the bulk counters to stats. */
+extern void bulk_stats(struct mm_stats *stats);
+
+/* Fork handlers for the state kept in bulk.c. */
+extern void bulk_fork_prepare(void);
+extern void bulk_fork_parent(void);
+extern void bulk_fork_child(void);
+
+/*
+ * Returns the class of the smallest pool block holding size bytes of
+ * data, with one table lookup.  Only meaningful for
+ * size <= SIZE_CLASS_MAX - BLOCK_HEADER.
  */
-static inline __attribute__((unused)) int block_index(size_t x) {
-    if (x <= 8) {
-        return 5;
-    } else {
-        return 32 - __builtin_clz((unsigned int)x + 7);
-    }
+static inline int size_class(size_t size)
+{
+	return gSizeClass[(size + BLOCK_HEADER + 7) >> 3];
 }
 
-static void create_node_data(MemNode *chunk, size_t size)
+static inline size_t class_size(int index)
 {
-	// alloc list
-	MemNode **list = &gMemDataTable->chunkList[block_index(size - sizeof(size_t)) - 5];
-	if (*list != NULL) {
-		(*list)->prev = chunk;
-	}
-	chunk->prev = NULL;
-	chunk->next = *list;
-	// create node
-	*list = chunk;
-	my_print("current index %d, mem size %lu, mem chunk: %p \n", block_index(size - sizeof(size_t)) - 5, size, chunk);
+	return gClassSize[index];
 }
 
-static void split_mm(void *bAddr, int alloc_size, int total_size)
+static Superblock *block_superblock(void *block)
 {
-	for (int size = 2048; size >= 32; size /= 2) 
-	{
-		while (total_size >= size) 
-		{
-			MemNode *node = bAddr + alloc_size;
-			node->header = size;
-			set_chunk_free_flag(node);
-			create_node_data(node, size);
+	return (Superblock *)((uintptr_t)block & SUPERBLOCK_MASK);
+}
+
+/* Returns the descriptor of the run holding block. */
+static ChunkDesc *block_chunk(void *block)
+{
+	Superblock *sb = block_superblock(block);
+	ChunkDesc *cd = &sb->chunks[((char *)block - (char *)sb) / CHUNK_SIZE];
+	return cd - cd->offset;
+}
+
+static char *chunk_base(ChunkDesc *cd)
+{
+	Superblock *sb = block_superblock(cd);
+	return (char *)sb + (cd - sb->chunks) * CHUNK_SIZE;
+}
+
+/* Records sb in the page map, or clears it when sb is being released. */
+static int pagemap_set(Superblock *sb, Superblock *value)
+{
+	uintptr_t key = (uintptr_t)sb >> SUPERBLOCK_SHIFT;
+	Superblock ***root = &gPageMap[key >> PAGEMAP_LEAF_BITS];
+	Superblock **leaf = __atomic_load_n(root, __ATOMIC_ACQUIRE);
 
-			total_size -= size;
-			alloc_size += size;
+	if (leaf == NULL) {
+		leaf = mmap(NULL, sizeof(Superblock *) << PAGEMAP_LEAF_BITS,
+					PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		COUNT_CALL(mmap);
+		if (leaf == MAP_FAILED) {
+			return -1;
+		}
+		Superblock **expected = NULL;
+		if (!__atomic_compare_exchange_n(root, &expected, leaf, 0,
+										 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			munmap(leaf, sizeof(Superblock *) << PAGEMAP_LEAF_BITS);
+			COUNT_CALL(munmap);
+			leaf = expected;
 		}
 	}
+	__atomic_store_n(&leaf[key & ((1 << PAGEMAP_LEAF_BITS) - 1)], value,
+					 __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Returns the superblock covering ptr, or NULL if ptr is not pool
+ * memory. */
+static inline __attribute__((unused)) Superblock *pagemap_lookup(void *ptr)
+{
+	uintptr_t key = (uintptr_t)ptr >> SUPERBLOCK_SHIFT;
+	if (key >> PAGEMAP_BITS)
+		return NULL;
+	Superblock **leaf = __atomic_load_n(&gPageMap[key >> PAGEMAP_LEAF_BITS],
+										__ATOMIC_ACQUIRE);
+	if (leaf == NULL)
+		return NULL;
+	return __atomic_load_n(&leaf[key & ((1 << PAGEMAP_LEAF_BITS) - 1)],
+						   __ATOMIC_ACQUIRE);
 }
 
 /*
- * You must implement malloc().  Your implementation of malloc() must be
- * the multi-pool allocator described in the project handout.
+ * Returns the class of the pool block holding ptr, or -1 if ptr is a
+ * mid-size or bulk block.
  */
- 
-void *malloc(size_t size)
+static int ptr_class(void *ptr)
 {
-	if (gMemDataTable == NULL) {
-		// create a piece of memory 
-		gMemDataTable = (MemList *)sbrk(CHUNK_SIZE);
-		if (gMemDataTable == NULL) {
-			return NULL;
+#ifdef MM_HEADERLESS
+	Superblock *sb = pagemap_lookup(ptr);
+	if (sb == NULL)
+		return -1;
+	int index = sb->chunks[((char *)ptr - (char *)sb) / CHUNK_SIZE].index;
+	return index < NCLASSES ? index : -1;
+#else
+	MemNode *block = ptr - BLOCK_HEADER;
+	size_t block_size = get_chunk_size(&block->header);
+	if (block_size > SIZE_CLASS_MAX)
+		return -1;
+	return gSizeClass[block_size >> 3];
+#endif
+}
+
+/* Returns the number of bytes the caller may use at ptr. */
+static size_t usable_size(void *ptr)
+{
+	int index = ptr_class(ptr);
+	if (index >= 0)
+		return class_size(index) - BLOCK_HEADER;
+	BulkNode *block = ptr - sizeof(size_t);
+	return get_chunk_size(&block->header) - sizeof(size_t);
+}
+
+/*
+ * Returns the pointer malloc() returned for the block holding ptr, which
+ * differs from ptr only for aligned allocations cut from a larger
+ * block.  Headerless pool blocks have no header to flag, but they are
+ * never cut; mid-size blocks always have a header.
+ */
+static void *aligned_origin(void *ptr)
+{
+#ifdef MM_HEADERLESS
+	if (ptr_class(ptr) >= 0)
+		return ptr;
+#endif
+	size_t word = *(size_t *)(ptr - sizeof(size_t));
+	if (word & CHUNK_ALIGNED)
+		return ptr - get_chunk_size(&word);
+	return ptr;
+}
+
+#ifdef MM_HARDENED
+static inline MemNode *link_encode(MemNode *block, MemNode *next)
+{
+	return (MemNode *)((uintptr_t)next ^ ((uintptr_t)&block->next >> 12) ^ gHardenSecret);
+}
+
+static inline MemNode *link_decode(MemNode *block)
+{
+	MemNode *next = link_encode(block, block->next);
+	HARDEN_CHECK(next == NULL || (((uintptr_t)next & 0x7) == 0 && pagemap_lookup(next) != NULL),
+				 "corrupted free list", block->data);
+	return next;
+}
+
+#define LINK_SET(block, value) ((block)->next = link_encode((block), (value)))
+#define LINK_GET(block) link_decode(block)
+#define HARDEN_BLOCK(ptr, index) harden_check((ptr), (index))
+
+/*
+ * Aborts unless ptr, of class index (-1 for bulk), has an intact header
+ * and lies where its class says it should: bulk blocks outside the pool,
+ * pool blocks on a block boundary of a run of their class.
+ */
+static void harden_check(void *ptr, int index)
+{
+	Superblock *sb = pagemap_lookup(ptr);
+	HARDEN_CHECK(sb != NULL || index < 0, "invalid pointer", ptr);
+	size_t *header = index >= 0 ? &((MemNode *)(ptr - BLOCK_HEADER))->header
+								: &((BulkNode *)(ptr - sizeof(size_t)))->header;
+	HARDEN_CHECK(((*header ^ header_canary(header)) & ~(HEADER_SIZE_MASK | 0x7)) == 0,
+				 "corrupted block header", ptr);
+	if (index >= 0) {
+		ChunkDesc *cd = block_chunk(header);
+		HARDEN_CHECK(cd->index == index &&
+					 ((char *)header - chunk_base(cd)) % class_size(index) == 0,
+					 "size class mismatch", ptr);
+	} else {
+		// of the blocks with a bulk header, only mid-size ones lie in the
+		// pool, each at the start of its run
+		int mid = get_chunk_size(header) <= MID_MAX;
+		HARDEN_CHECK((sb != NULL) == mid, "invalid pointer", ptr);
+		if (mid) {
+			ChunkDesc *cd = &sb->chunks[((char *)header - (char *)sb) / CHUNK_SIZE];
+			HARDEN_CHECK(cd->index == CHUNK_MID && cd->offset == 0 &&
+						 ((uintptr_t)header & (CHUNK_SIZE - 1)) == 0,
+						 "invalid pointer", ptr);
 		}
-		// reset this memory
-		memset(gMemDataTable, 0, sizeof(MemList));
 	}
-	if (size <= 0) {
+}
+#else
+#define LINK_SET(block, value) ((block)->next = (value))
+#define LINK_GET(block) ((block)->next)
+#define HARDEN_BLOCK(ptr, index) do { } while (0)
+#endif
+
+static void list_add_chunk(Arena *arena, ChunkDesc *cd)
+{
+	ChunkDesc **list = &arena->pools.chunkList[cd->index];
+	if (*list != NULL) {
+		(*list)->prev = cd;
+	}
+	cd->prev = NULL;
+	cd->next = *list;
+	*list = cd;
+	cd->listed = 1;
+}
+
+static void list_remove_chunk(Arena *arena, ChunkDesc *cd)
+{
+	if (cd->prev != NULL)
+		cd->prev->next = cd->next;
+	else
+		arena->pools.chunkList[cd->index] = cd->next;
+	if (cd->next != NULL)
+		cd->next->prev = cd->prev;
+	cd->listed = 0;
+}
+
+/* Milliseconds on a coarse monotonic clock, which wraps every 49 days;
+ * only differences of up to DECAY_MS or so are ever taken. */
+static unsigned int decay_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (unsigned int)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* The free list for runs of n chunks. */
+static inline int run_bin(size_t n)
+{
+	if (n <= RUN_EXACT)
+		return n - 1;
+	int lg = 63 - __builtin_clzl(n);
+	return RUN_EXACT + 4 * (lg - 4) + ((n >> (lg - 2)) & 3);
+}
+
+/* Lists the n chunks at cd as a free run and tags its last chunk. */
+static void run_push(Arena *arena, ChunkDesc *cd, size_t n, int zero)
+{
+	int bin = run_bin(n);
+	ChunkDesc **list = &arena->freeRuns[bin];
+	cd->index = CHUNK_FREE;
+	cd->chunks = n;
+	cd->zero = zero;
+	cd->freed = decay_clock();
+	cd->offset = 0;
+	cd->prev = NULL;
+	cd->next = *list;
+	if (*list != NULL)
+		(*list)->prev = cd;
+	*list = cd;
+	arena->runBins |= (uint64_t)1 << bin;
+	cd[n - 1].index = CHUNK_FREE;
+	cd[n - 1].offset = n - 1;
+}
+
+static void run_unlink(Arena *arena, ChunkDesc *cd)
+{
+	int bin = run_bin(cd->chunks);
+	if (cd->prev != NULL)
+		cd->prev->next = cd->next;
+	else if ((arena->freeRuns[bin] = cd->next) == NULL)
+		arena->runBins &= ~((uint64_t)1 << bin);
+	if (cd->next != NULL)
+		cd->next->prev = cd->prev;
+}
+
+/*
+ * Maps a new superblock for the arena and hands its chunks to the buddy
+ * lists.  The mapping is over-allocated by SUPERBLOCK_SIZE and trimmed so
+ * that it is aligned to its own size.
+ */
+static Superblock *superblock_create(Arena *arena)
+{
+	char *map = mmap(NULL, 2 * SUPERBLOCK_SIZE, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	COUNT_CALL(mmap);
+	if (map == MAP_FAILED) {
 		return NULL;
 	}
-	
-	// alignment  size of memroy
-	size_t get_size = alignment(size);
-	my_print("alignment size = %lu, get_size = %lu \n", size, get_size);
-	
-	if (get_size <= (CHUNK_SIZE - sizeof(size_t)))
-	{
-		int index = block_index(get_size) - 5;
-		// Traversing the list
-		for (int i = index; i < 8; i++)
-		{
-			MemNode **list = &gMemDataTable->chunkList[i];
-			if (*list != NULL) 
-			{
-				MemNode *ptr = *list;
-				*list = (*list)->next;
-				if (*list != NULL)
-				{
-					(*list)->prev = NULL;
-				}
-				// get useless block
-				ptr->next = NULL;
-				my_print("Get block in %d, block %p, return %p \n", i, ptr, ptr->data);
-				set_chunk_alloc_flag(ptr);
-				return ptr->data;
-			}
-		}
-		MemNode *block = (MemNode *)sbrk(CHUNK_SIZE);
-		if (block == NULL) {
-			return NULL;
-		}
-		// get alloc size
-		size_t alloc_size = _pow(2, block_index(get_size));
-		// put the size to the node header
-		block->header = alloc_size;
-		my_print("alloc size %lu, block %p, return %p \n", alloc_size, block, block->data);
-		
-		// setup this mem flag
-		set_chunk_alloc_flag(block);
-		split_mm(block, alloc_size, CHUNK_SIZE - alloc_size);
-		
-		return block->data;
-	} else {
-		MemNode *newptr = bulk_alloc(get_size + sizeof(size_t));
-		newptr->header = get_size + sizeof(size_t);
-		set_chunk_alloc_flag(newptr);
-		my_print("alloc mem size %lu, block addr %p, data %p", get_size + sizeof(size_t), newptr, newptr->data);
-		return newptr->data;
+	char *base = (char *)(((uintptr_t)map + SUPERBLOCK_SIZE - 1) & SUPERBLOCK_MASK);
+	if (base > map) {
+		munmap(map, base - map);
+		COUNT_CALL(munmap);
+	}
+	munmap(base + SUPERBLOCK_SIZE, map + SUPERBLOCK_SIZE - base);
+	COUNT_CALL(munmap);
+	numa_bind(base, SUPERBLOCK_SIZE, arena->node);
+
+	Superblock *sb = (Superblock *)base;
+	if (pagemap_set(sb, sb) != 0) {
+		munmap(base, SUPERBLOCK_SIZE);
+		COUNT_CALL(munmap);
+		return NULL;
 	}
+	COUNT_CALL(superblocks);
+	bulk_advise_huge(base, SUPERBLOCK_SIZE);
+	sb->arena = arena;
+	sb->used = 0;
+	sb->prev = NULL;
+	sb->next = arena->superblocks;
+	if (sb->next != NULL)
+		sb->next->prev = sb;
+	arena->superblocks = sb;
+
+	// the chunks after the header make up one free run
+	size_t first = SUPERBLOCK_HEADER / CHUNK_SIZE;
+	for (size_t i = 0; i < first; i++)
+		sb->chunks[i].index = CHUNK_HEADER;
+	run_push(arena, &sb->chunks[first], SUPERBLOCK_CHUNKS - first, 1);
+	my_print("arena %p superblock %p \n", arena, sb);
+	return sb;
 }
 
 /*
- * You must also implement calloc().  It should create allocations
- * compatible with those created by malloc().  In particular, any
- * allocations of a total size <= 4088 bytes must be pool allocated,
- * while larger allocations must use the bulk allocator.
- *
- * calloc() (see man 3 calloc) returns a cleared allocation large enough
- * to hold nmemb elements of size size.  It is cleared by setting every
- * byte of the allocation to 0.  You should use the function memset()
- * for this (see man 3 memset).
+ * Called once every run of sb has been freed and merged back into one:
+ * takes that run off its list and returns the memory to the OS.
  */
-void *calloc(size_t nmemb, size_t size)
+static void superblock_release(Arena *arena, Superblock *sb)
 {
-	
-	size_t get_size = alignment(nmemb * size);
-    void *ptr = malloc(get_size);
-	if (ptr != NULL)
-		memset(ptr, 0, get_size);
-	my_print("clear mem size %lu, return %p \n", get_size, ptr);
+	ChunkDesc *cd = &sb->chunks[SUPERBLOCK_HEADER / CHUNK_SIZE];
+	my_print("arena %p release superblock %p \n", arena, sb);
+	if (arena->superblocks == sb && sb->next == NULL) {
+		// keep the arena's last superblock mapped, but drop its pages;
+		// they read back as zeros
+		madvise((char *)sb + SUPERBLOCK_HEADER,
+				SUPERBLOCK_SIZE - SUPERBLOCK_HEADER, MADV_DONTNEED);
+		COUNT_CALL(madvise);
+		cd->zero = 1;
+		return;
+	}
+	run_unlink(arena, cd);
+	if (sb->prev != NULL)
+		sb->prev->next = sb->next;
+	else
+		arena->superblocks = sb->next;
+	if (sb->next != NULL)
+		sb->next->prev = sb->prev;
+	pagemap_set(sb, NULL);
+	munmap(sb, SUPERBLOCK_SIZE);
+	COUNT_CALL(munmap);
+	__atomic_fetch_sub(&gPoolCalls.superblocks, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns a free run of at least n chunks, or NULL if there is none.
+ * The runs on a list shared by several lengths are searched for the
+ * first that fits; any run on a later list is long enough. */
+static ChunkDesc *run_find(Arena *arena, size_t n)
+{
+	int bin = run_bin(n);
+	for (ChunkDesc *cd = arena->freeRuns[bin]; cd != NULL; cd = cd->next) {
+		if (cd->chunks >= n)
+			return cd;
+	}
+	uint64_t later = arena->runBins & ~(((uint64_t)2 << bin) - 1);
+	if (later == 0)
+		return NULL;
+	return arena->freeRuns[__builtin_ctzll(later)];
+}
 
-    return ptr;
+/* Marks every chunk of the run at cd as belonging to index, so that
+ * pointers into it find the run and the run is never taken for free. */
+static void run_mark(ChunkDesc *cd, size_t n, int index)
+{
+	for (size_t i = 0; i < n; i++) {
+		cd[i].index = index;
+		cd[i].offset = i;
+	}
 }
 
 /*
- * You must also implement realloc().  It should create allocations
- * compatible with those created by malloc(), honoring the pool
- * alocation and bulk allocation rules.  It must move data from the
- * previously-allocated block to the newly-allocated block if it cannot
- * resize the given block directly.  See man 3 realloc for more
- * information on what this means.
- *
- * It is not possible to implement realloc() using bulk_alloc() without
- * additional metadata, so the given code is NOT a working
- * implementation!
+ * Takes a run of n chunks for index, splitting the remainder off a
+ * longer free run and mapping a new superblock if no free run is long
+ * enough.
  */
-void *realloc(void *ptr, size_t size)
+static ChunkDesc *run_alloc(Arena *arena, size_t n, int index)
 {
-	size_t get_size = alignment(size);
-	if (ptr == NULL) 
-	{
-		return malloc(get_size);
-	} 
-	else
-	{
-		if (get_size == 0) 
-		{
-			free(ptr);
+	if (n == 0)
+		return NULL;
+	ChunkDesc *cd = run_find(arena, n);
+	if (cd == NULL) {
+		if (superblock_create(arena) == NULL)
 			return NULL;
+		cd = run_find(arena, n);
+	}
+	run_unlink(arena, cd);
+	if (cd->chunks > n)
+		run_push(arena, cd + n, cd->chunks - n, cd->zero);
+	run_mark(cd, n, index);
+	cd->chunks = n;
+	block_superblock(cd)->used += n;
+	return cd;
+}
+
+/*
+ * Returns the run at cd to the arena, merging it with the free runs on
+ * either side.
+ */
+static void run_free(Arena *arena, ChunkDesc *cd)
+{
+	Superblock *sb = block_superblock(cd);
+	size_t i = cd - sb->chunks;
+	size_t n = cd->chunks;
+	sb->used -= n;
+	if (i + n < SUPERBLOCK_CHUNKS && sb->chunks[i + n].index == CHUNK_FREE) {
+		ChunkDesc *next = &sb->chunks[i + n];
+		run_unlink(arena, next);
+		n += next->chunks;
+	}
+	// the chunk before is the last of its run; header chunks stop this
+	if (sb->chunks[i - 1].index == CHUNK_FREE) {
+		ChunkDesc *prev = &sb->chunks[i - 1];
+		prev -= prev->offset;
+		run_unlink(arena, prev);
+		i -= prev->chunks;
+		n += prev->chunks;
+	}
+	run_push(arena, &sb->chunks[i], n, 0);
+	if (sb->used == 0) {
+		if (gDecayMs == 0)
+			superblock_release(arena, sb);
+		else
+			sb->idle = sb->chunks[i].freed;
+	}
+}
+
+/*
+ * Hands back to the OS the free memory of the arena that has been unused
+ * for at least decay milliseconds at time now: empty superblocks other
+ * than the arena's last are unmapped, and free runs not known to be
+ * zero are purged.  Returns the number of bytes released.  Must be
+ * called with the arena lock held.
+ */
+static size_t arena_decay(Arena *arena, unsigned int now, unsigned int decay)
+{
+	size_t released = 0;
+	Superblock *next;
+	for (Superblock *sb = arena->superblocks; sb != NULL; sb = next) {
+		next = sb->next;
+		if (sb->used == 0 && now - sb->idle >= decay &&
+			(sb != arena->superblocks || sb->next != NULL)) {
+			superblock_release(arena, sb);
+			released += SUPERBLOCK_SIZE;
 		}
-		else 
-		{
-			MemNode *block = ptr - sizeof(size_t);
-			size_t block_size = get_chunk_size(block);
-			my_print(" realloc mem size %lu, get_size %lu, block_size %lu \n", size, get_size, block_size);
-			if (get_size == (block_size - sizeof(size_t))) 
-			{				
-				// get the same size,return ptr
-				return ptr;
-			}
-			
-			if (CHUNK_SIZE >= block_size)
-			{
-				if (block_index(get_size) == block_index(block_size - sizeof(size_t))) 
-				{
-					my_print("get the same power and will return %p \n", ptr);
-					return ptr;
-				} 
-				else 
-				{
-					
-					char mem_data[CHUNK_SIZE] = {0};
-					// backup this mem data
-					memcpy(mem_data, ptr, block_size - sizeof(size_t));
-					// free this ptr
-					free(ptr);
-					
-					void *newPtr = malloc(get_size);
-					MemNode *newBlock = newPtr - sizeof(size_t);
-					size_t newBlockSize = get_chunk_size(newBlock);
-					// new block size and put backup data to the mem
-					if (newBlockSize < block_size) 
-					{
-						memcpy(newPtr, mem_data, newBlockSize - sizeof(size_t));
-					} 
-					else 
-					{
-						memcpy(newPtr, mem_data, block_size - sizeof(size_t));
-					}
-					return newPtr;
-				}
-			}
-			else 
-			{
-				// backup this mem data
-				void *newPtr = malloc(get_size);
-				MemNode *newBlock = newPtr - sizeof(size_t);
-				size_t newBlockSize = get_chunk_size(newBlock);
-				//new block size and put backup data to the mem
-				if (newBlockSize < block_size) 
-				{
-					memcpy(newPtr, ptr, newBlockSize - sizeof(size_t));
-				} 
-				else 
-				{
-					memcpy(newPtr, ptr, block_size - sizeof(size_t));
-				}
-				// free this ptr
-				free(ptr);
-				return newPtr;
-			}
+	}
+	for (int bin = 0; bin < RUN_BINS; bin++) {
+		for (ChunkDesc *cd = arena->freeRuns[bin]; cd != NULL; cd = cd->next) {
+			if (cd->zero || now - cd->freed < decay)
+				continue;
+			madvise(chunk_base(cd), (size_t)CHUNK_SIZE * cd->chunks, MADV_DONTNEED);
+			COUNT_CALL(madvise);
+			cd->zero = 1;
+			released += (size_t)CHUNK_SIZE * cd->chunks;
 		}
 	}
+	return released;
+}
+
+/* Runs a decay pass over the arena if one is due.  Must be called with
+ * the arena lock held. */
+static void arena_tick(Arena *arena)
+{
+	if (gDecayMs == 0)
+		return;
+	unsigned int now = decay_clock();
+	if ((int)(now - arena->decayNext) < 0)
+		return;
+	arena->decayNext = now + gDecayMs / 4 + 1;
+	arena_decay(arena, now, gDecayMs);
 }
 
 /*
- * You should implement a free() that can successfully free a region of
- * memory allocated by any of the above allocation routines, whether it
- * is a pool- or bulk-allocated region.
- *
- * The given implementation does nothing.
+ * Takes a run of chunks for class index from the arena's free runs and
+ * lists it for the class.  Must be called with the arena lock held.
  */
-void free(void *ptr)
+static ChunkDesc *arena_chunk(Arena *arena, int index)
 {
-	if (ptr == NULL) {
-		return;
+	ChunkDesc *cd = run_alloc(arena, gClassChunks[index], index);
+	if (cd == NULL) {
+		return NULL;
 	}
+	cd->free = NULL;
+	cd->live = 0;
+	cd->carved = 0;
+	arena->blocks[index] += gClassBlocks[index];
+	list_add_chunk(arena, cd);
+	my_print("alloc chunk %p for size %lu \n", chunk_base(cd), class_size(index));
+	return cd;
+}
 
-	MemNode *block = ptr - sizeof(size_t);
-	if (get_chunk_free_flag(block))
-		return;
-	
-	
-	set_chunk_free_flag(block);
-	if (block->header <= CHUNK_SIZE) {
-		my_print("free mem: %p and size %lu \n", ptr, block->header);
-		create_node_data(block, block->header);
+/* Takes one block off a listed chunk, carving a new one if the chunk
+ * has no free blocks left.  If zero is not NULL, *zero tells whether the
+ * block's data is known to be all zeros. */
+static MemNode *chunk_take(Arena *arena, ChunkDesc *cd, int *zero)
+{
+	MemNode *block = cd->free;
+	if (zero != NULL)
+		*zero = block == NULL && cd->zero;
+	if (block != NULL) {
+		cd->free = LINK_GET(block);
 	} else {
-		my_print("free mem: %p and size %lu \n", ptr, block->header);
-		bulk_free(block, block->header);
+		block = (MemNode *)(chunk_base(cd) + cd->carved * class_size(cd->index));
+#ifndef MM_HEADERLESS
+		SET_HEADER(block, class_size(cd->index));
+#endif
+		cd->carved++;
+	}
+	cd->live++;
+	if (cd->free == NULL && cd->carved == gClassBlocks[cd->index])
+		list_remove_chunk(arena, cd);
+	return block;
+}
+
+/*
+ * Puts a block back on its chunk.  Must be called with the lock of the
+ * arena owning the block's superblock held.
+ */
+static void arena_free_block(Arena *arena, MemNode *block)
+{
+	ChunkDesc *cd = block_chunk(block);
+	LINK_SET(block, cd->free);
+	cd->free = block;
+	cd->live--;
+	if (!cd->listed)
+		list_add_chunk(arena, cd);
+	// an empty run goes back to the free runs, unless it is the only
+	// one the class has to allocate from
+	if (cd->live == 0 && (cd->prev != NULL || cd->next != NULL)) {
+		list_remove_chunk(arena, cd);
+		arena->blocks[cd->index] -= gClassBlocks[cd->index];
+		run_free(arena, cd);
+	}
+}
+
+/* Pushes a block freed by another arena's thread onto arena's remote
+ * list.  Takes no lock.  A mid-size run is pushed as the node at its
+ * data, past its header, and is told apart by its chunk index when the
+ * list is drained. */
+static void remote_free(Arena *arena, MemNode *block)
+{
+	MemNode *head = __atomic_load_n(&arena->remote, __ATOMIC_RELAXED);
+	do {
+		LINK_SET(block, head);
+	} while (!__atomic_compare_exchange_n(&arena->remote, &head, block, 1,
+										  __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Puts every block on the arena's remote list back on its chunk.  Must be
+ * called with the arena lock held.
+ */
+static void remote_drain(Arena *arena)
+{
+	if (__atomic_load_n(&arena->remote, __ATOMIC_RELAXED) == NULL)
+		return;
+	MemNode *block = __atomic_exchange_n(&arena->remote, NULL, __ATOMIC_ACQUIRE);
+	while (block != NULL) {
+		MemNode *next = LINK_GET(block);
+		ChunkDesc *cd = block_chunk(block);
+		if (cd->index == CHUNK_MID)
+			run_free(arena, cd);
+		else
+			arena_free_block(arena, block);
+		block = next;
+	}
+}
+
+/*
+ * Takes a block of class index from the arena, carving a fresh chunk
+ * when no listed chunk has one.  Blocks on the remote list are taken
+ * back first, and a decay pass is run if one is due.  If tc is not NULL, up to TCACHE_BATCH - 1 further blocks
+ * of the same class are moved into it so the next few allocations skip
+ * the lock.  zero is passed on to chunk_take() for the returned block.
+ *
+ * Must be called with the arena lock held.  Returns NULL on failure.
+ */
+static MemNode *arena_alloc(Arena *arena, int index, TCache *tc, int *zero)
+{
+	remote_drain(arena);
+	arena_tick(arena);
+	ChunkDesc *cd = arena->pools.chunkList[index];
+	if (cd == NULL) {
+		cd = arena_chunk(arena, index);
+		if (cd == NULL) {
+			return NULL;
+		}
 	}
-	
-    return;
+	MemNode *block = chunk_take(arena, cd, zero);
+	my_print("Get block in %d, block %p \n", index, block);
+	if (tc != NULL) {
+		// refill the thread cache from the listed chunks
+		while (tc->count[index] < TCACHE_BATCH - 1) {
+			cd = arena->pools.chunkList[index];
+			if (cd == NULL)
+				break;
+			MemNode *extra = chunk_take(arena, cd, NULL);
+#ifndef MM_HEADERLESS
+			set_chunk_free_flag(&extra->header);
+#endif
+			LINK_SET(extra, tc->bins[index]);
+			tc->bins[index] = extra;
+			tc->count[index]++;
+		}
+	}
+	return block;
+}
+
+static void cache_fork_prepare(void);
+static void cache_fork_parent(void);
+static void cache_fork_child(void);
+
+static void arena_fork_prepare(void)
+{
+	cache_fork_prepare();
+	for (unsigned int i = 0; i < gArenaCount; i++)
+		pthread_mutex_lock(&gArenas[i].lock);
+	bulk_fork_prepare();
+	prof_fork_prepare();
+}
+
+static void arena_fork_parent(void)
+{
+	prof_fork_parent();
+	bulk_fork_parent();
+	for (unsigned int i = 0; i < gArenaCount; i++)
+		pthread_mutex_unlock(&gArenas[i].lock);
+	cache_fork_parent();
+}
+
+static void arena_fork_child(void)
+{
+	prof_fork_child();
+	bulk_fork_child();
+	for (unsigned int i = 0; i < gArenaCount; i++)
+		pthread_mutex_init(&gArenas[i].lock, NULL);
+	cache_fork_child();
+}
+
+static void stats_signal(int sig)
+{
+	malloc_stats();
+}
+
+static void arena_init(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *env = getenv("MM_ARENAS");
+	if (env != NULL && atoi(env) > 0)
+		count = atoi(env);
+	if (count < 1)
+		count = 1;
+	if (count > MAX_ARENAS)
+		count = MAX_ARENAS;
+
+	// split the arenas between the NUMA nodes
+	gNodeCount = numa_nodes();
+	if (gNodeCount > MAX_ARENAS)
+		gNodeCount = MAX_ARENAS;
+	gNodeArenas = (count + gNodeCount - 1) / gNodeCount;
+	if (gNodeArenas * gNodeCount > MAX_ARENAS)
+		gNodeArenas = MAX_ARENAS / gNodeCount;
+	count = gNodeArenas * gNodeCount;
+
+	env = getenv("MM_ARENA_POLICY");
+	gArenaByCpu = env != NULL && strcmp(env, "cpu") == 0;
+
+	gDecayMs = DECAY_MS;
+	env = getenv("MM_DECAY_MS");
+	if (env != NULL)
+		gDecayMs = strtoul(env, NULL, 0);
+	env = getenv("MM_DECAY_THREAD");
+	gDecayThread = gDecayMs > 0 && env != NULL && atoi(env) > 0;
+
+#ifdef MM_HARDENED
+	// the kernel passes every process 16 random bytes
+	const unsigned char *random = (const unsigned char *)getauxval(AT_RANDOM);
+	if (random != NULL)
+		memcpy(&gHardenSecret, random + 8, sizeof(gHardenSecret));
+	gHardenSecret ^= ((uintptr_t)&gHardenSecret ^ (uintptr_t)time(NULL)) * 0x9e3779b97f4a7c15ULL;
+#endif
+
+	for (long i = 0; i < count; i++) {
+		pthread_mutex_init(&gArenas[i].lock, NULL);
+		gArenas[i].node = i / gNodeArenas;
+	}
+	gArenaCount = count;
+	pthread_atfork(arena_fork_prepare, arena_fork_parent, arena_fork_child);
+
+	// MM_STATS_SIGNAL=n dumps the statistics to stderr on signal n
+	env = getenv("MM_STATS_SIGNAL");
+	if (env != NULL && atoi(env) > 0) {
+		struct sigaction sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = stats_signal;
+		sa.sa_flags = SA_RESTART;
+		sigaction(atoi(env), &sa, NULL);
+	}
+}
+
+/* Background decay: every quarter interval, runs the decay passes that
+ * are due and expires old cached bulk mappings. */
+static void *decay_main(void *arg)
+{
+	unsigned int ms = gDecayMs / 4 + 1;
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	for (;;) {
+		nanosleep(&ts, NULL);
+		for (unsigned int i = 0; i < gArenaCount; i++) {
+			pthread_mutex_lock(&gArenas[i].lock);
+			arena_tick(&gArenas[i]);
+			pthread_mutex_unlock(&gArenas[i].lock);
+		}
+		bulk_trim(0);
+	}
+	return NULL;
+}
+
+/* Starts the decay thread if MM_DECAY_THREAD asks for one.  Called
+ * after the calling thread has its arena, since pthread_create() may
+ * allocate. */
+static void decay_start(void)
+{
+	static int started;
+	pthread_t thread;
+	pthread_attr_t attr;
+	if (!gDecayThread || __atomic_exchange_n(&started, 1, __ATOMIC_ACQ_REL))
+		return;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_create(&thread, &attr, decay_main, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+/* Returns the arena the calling thread allocates from, assigning one on
+ * first use. */
+static Arena *thread_arena(void)
+{
+	if (gThreadArena != NULL)
+		return gThreadArena;
+
+	pthread_once(&gArenaOnce, arena_init);
+	unsigned int index;
+	int cpu = gArenaByCpu || gNodeCount > 1 ? sched_getcpu() : -1;
+	unsigned int node = gNodeCount > 1 ? numa_cpu_node(cpu) : 0;
+	if (node >= gNodeCount)
+		node = 0;
+	if (gArenaByCpu && cpu >= 0)
+		index = cpu % gNodeArenas;
+	else
+		index = __atomic_fetch_add(&gArenaNext[node], 1, __ATOMIC_RELAXED) % gNodeArenas;
+	index += node * gNodeArenas;
+	gThreadArena = &gArenas[index];
+	my_print("thread arena %u node %u \n", index, node);
+	decay_start();
+	return gThreadArena;
+}
+
+/*
+ * Moves all but keep blocks of one thread cache bin back to the arenas
+ * that own them.  Consecutive blocks of the same arena share one lock
+ * acquisition.
+ */
+static void tcache_flush(TCache *tc, int index, unsigned int keep)
+{
+	Arena *locked = NULL;
+	while (tc->count[index] > keep) {
+		MemNode *block = tc->bins[index];
+		tc->bins[index] = LINK_GET(block);
+		tc->count[index]--;
+		Arena *arena = block_superblock(block)->arena;
+		if (arena != locked) {
+			if (locked != NULL)
+				pthread_mutex_unlock(&locked->lock);
+			pthread_mutex_lock(&arena->lock);
+			remote_drain(arena);
+			locked = arena;
+		}
+		arena_free_block(arena, block);
+	}
+	if (locked != NULL) {
+		arena_tick(locked);
+		pthread_mutex_unlock(&locked->lock);
+	}
+}
+
+/* Thread exit destructor: hand every cached block back to its arena.
+ * Frees that happen later in thread teardown go straight to the arenas
+ * as well. */
+static void tcache_destroy(void *arg)
+{
+	TCache *tc = arg;
+	for (int i = 0; i < NCLASSES; i++) {
+		if (tc->count[i] > 0)
+			tcache_flush(tc, i, 0);
+	}
+	if (tc->stats != NULL) {
+		__atomic_store_n(&tc->stats->inUse, 0, __ATOMIC_RELEASE);
+		tc->stats = NULL;
+	}
+	gTCacheState = TCACHE_DEAD;
+}
+
+/* Takes a counter record no live thread is using, mapping a new one if
+ * there is none.  Returns NULL if that fails. */
+static ThreadStats *stats_acquire(void)
+{
+	for (ThreadStats *st = __atomic_load_n(&gStatsList, __ATOMIC_ACQUIRE);
+		 st != NULL; st = st->next) {
+		int expected = 0;
+		if (__atomic_compare_exchange_n(&st->inUse, &expected, 1, 0,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return st;
+	}
+	ThreadStats *st = mmap(NULL, sizeof(ThreadStats), PROT_READ | PROT_WRITE,
+						   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	COUNT_CALL(mmap);
+	if (st == MAP_FAILED)
+		return NULL;
+	st->inUse = 1;
+	st->next = __atomic_load_n(&gStatsList, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&gStatsList, &st->next, st, 0,
+										__ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	return st;
+}
+
+static void tcache_key_init(void)
+{
+	pthread_key_create(&gTCacheKey, tcache_destroy);
+}
+
+/* Returns the calling thread's cache, or NULL once the thread is being
+ * torn down.  The state is marked active before the pthread calls so
+ * that any allocation they make is served without recursing here. */
+static TCache *tcache_get(void)
+{
+	if (gTCacheState == TCACHE_ACTIVE)
+		return &gTCache;
+	if (gTCacheState == TCACHE_DEAD)
+		return NULL;
+	gTCacheState = TCACHE_ACTIVE;
+	pthread_once(&gTCacheOnce, tcache_key_init);
+	pthread_setspecific(gTCacheKey, &gTCache);
+	gTCache.stats = stats_acquire();
+	return &gTCache;
+}
+
+/*
+ * You must implement malloc().  Your implementation of malloc() must be
+ * the multi-pool allocator described in the project handout.
+ */
+
+/*
+ * Called when the thread's sampling countdown runs out: samples the
+ * block at ptr if profiling is on, and starts the next countdown.  While
+ * the sample is taken the countdown is parked at LONG_MAX, so that
+ * allocations made by backtrace() are not sampled in turn.
+ */
+static void __attribute__((noinline)) prof_sample(void *ptr, size_t size)
+{
+	gProfBytes = LONG_MAX;
+	if (ptr != NULL && gProfOn) {
+		void *origin = aligned_origin(ptr);
+		if (prof_record(origin, size) == 0) {
+			int index = ptr_class(origin);
+#ifdef MM_HEADERLESS
+			if (index < 0)
+				((BulkNode *)(origin - sizeof(size_t)))->header |= CHUNK_SAMPLED;
+#else
+			size_t *header = index >= 0 ? &((MemNode *)(origin - BLOCK_HEADER))->header
+										: &((BulkNode *)(origin - sizeof(size_t)))->header;
+			*header |= CHUNK_SAMPLED;
+#endif
+		}
+	}
+	gProfBytes = prof_interval();
+}
+
+/* Counts size bytes against the thread's sampling countdown: with the
+ * profiler off, this decrement is all an allocation pays. */
+static inline void *prof_hook(void *ptr, size_t size)
+{
+	if (__builtin_expect((gProfBytes -= (long)size) < 0, 0))
+		prof_sample(ptr, size);
+	return ptr;
+}
+
+/*
+ * Drops the profile sample of the block at ptr, of class index (-1 for
+ * bulk), if it has one.  Only called while profiling is on.
+ */
+static void prof_unsample(void *ptr, int index)
+{
+#ifdef MM_HEADERLESS
+	if (index >= 0) {
+		prof_release(ptr);
+		return;
+	}
+	size_t *header = &((BulkNode *)(ptr - sizeof(size_t)))->header;
+#else
+	size_t *header = index >= 0 ? &((MemNode *)(ptr - BLOCK_HEADER))->header
+								: &((BulkNode *)(ptr - sizeof(size_t)))->header;
+#endif
+	if (*header & CHUNK_SAMPLED) {
+		*header &= ~(size_t)CHUNK_SAMPLED;
+		prof_release(ptr);
+	}
+}
+
+/*
+ * Allocates a pool block of class index for a request of size bytes.
+ * *zero tells whether its data is known to be all zeros, which only
+ * fresh blocks taken from the arena can be.
+ */
+static void *pool_alloc(int index, size_t size, int *zero)
+{
+	TCache *tc = tcache_get();
+	MemNode *block;
+	if (tc != NULL && tc->bins[index] != NULL)
+	{
+		block = tc->bins[index];
+		tc->bins[index] = LINK_GET(block);
+		tc->count[index]--;
+		*zero = 0;
+	}
+	else
+	{
+		Arena *arena = thread_arena();
+		pthread_mutex_lock(&arena->lock);
+		block = arena_alloc(arena, index, tc, zero);
+		pthread_mutex_unlock(&arena->lock);
+		if (block == NULL) {
+			return NULL;
+		}
+	}
+	STATS_ADD(tc, allocs[index], 1);
+	STATS_ADD(tc, requested, size);
+#ifndef MM_HEADERLESS
+	// setup this mem flag
+	set_chunk_alloc_flag(&block->header);
+#endif
+	return block->data;
+}
+
+/* Takes a mid-size run for a block of size bytes, header included,
+ * cleared if zero is set. */
+static BulkNode *mid_alloc(size_t size, int zero)
+{
+	Arena *arena = thread_arena();
+	pthread_mutex_lock(&arena->lock);
+	remote_drain(arena);
+	arena_tick(arena);
+	ChunkDesc *cd = run_alloc(arena, (size + CHUNK_SIZE - 1) / CHUNK_SIZE, CHUNK_MID);
+	pthread_mutex_unlock(&arena->lock);
+	if (cd == NULL)
+		return NULL;
+	BulkNode *block = (BulkNode *)chunk_base(cd);
+	if (zero && !cd->zero)
+		memset(block, 0, size);
+	return block;
+}
+
+/* Returns a mid-size run to its arena, through the arena's remote list
+ * when the run belongs to another thread's arena, so that a consumer
+ * never takes the producer's lock. */
+static void mid_free(BulkNode *block)
+{
+	ChunkDesc *cd = block_chunk(block);
+	Arena *arena = block_superblock(cd)->arena;
+	if (arena != gThreadArena) {
+		remote_free(arena, (MemNode *)block->data);
+		return;
+	}
+	pthread_mutex_lock(&arena->lock);
+	run_free(arena, cd);
+	arena_tick(arena);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/*
+ * Resizes the mid-size run of block in place to hold size bytes, taking
+ * chunks from the free run after it or handing back the ones it no
+ * longer needs.  Returns 0, or -1 if the run cannot grow.
+ */
+static int mid_resize(BulkNode *block, size_t size)
+{
+	ChunkDesc *cd = block_chunk(block);
+	Superblock *sb = block_superblock(cd);
+	Arena *arena = sb->arena;
+	size_t n = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	size_t end = cd - sb->chunks + cd->chunks;
+	int result = 0;
+
+	pthread_mutex_lock(&arena->lock);
+	if (n < cd->chunks) {
+		ChunkDesc *tail = cd + n;
+		tail->chunks = cd->chunks - n;
+		cd->chunks = n;
+		run_free(arena, tail);
+	} else if (n > cd->chunks) {
+		ChunkDesc *next = &sb->chunks[end];
+		size_t extra = n - cd->chunks;
+		if (end < SUPERBLOCK_CHUNKS && next->index == CHUNK_FREE && next->chunks >= extra) {
+			run_unlink(arena, next);
+			if (next->chunks > extra)
+				run_push(arena, next + extra, next->chunks - extra, next->zero);
+			run_mark(cd, n, CHUNK_MID);
+			cd->chunks = n;
+			sb->used += extra;
+		} else {
+			result = -1;
+		}
+	}
+	pthread_mutex_unlock(&arena->lock);
+	return result;
+}
+
+/*
+ * Allocates a block with a bulk header for get_size bytes of data,
+ * cleared if zero is set: a mid-size run, or a mapping of its own past
+ * MID_MAX.
+ */
+static void *bulk_block(size_t get_size, int zero)
+{
+	// the header must not wrap the size around to a mid-size one
+	if (get_size > PTRDIFF_MAX - sizeof(size_t)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t size = get_size + sizeof(size_t);
+#ifdef MM_HARDENED
+	// the header canary needs the secret
+	pthread_once(&gArenaOnce, arena_init);
+#endif
+	int mid = size <= MID_MAX;
+	BulkNode *newptr = mid ? mid_alloc(size, zero) : zero ? bulk_calloc(size) : bulk_alloc(size);
+	if (newptr == NULL) {
+		return NULL;
+	}
+	SET_HEADER(newptr, size);
+	set_chunk_alloc_flag(&newptr->header);
+	TCache *tc = tcache_get();
+	if (mid) {
+		STATS_ADD(tc, midAllocs, 1);
+		STATS_ADD(tc, midBytes, size);
+		return newptr->data;
+	}
+	STATS_ADD(tc, bulkAllocs, 1);
+	STATS_ADD(tc, bulkBytes, size);
+	my_print("alloc mem size %lu, block addr %p, data %p", size, newptr, newptr->data);
+	return newptr->data;
+}
+
+/* malloc() without the profiler hook. */
+static void *plain_malloc(size_t size)
+{
+	if (size <= 0) {
+		return NULL;
+	}
+	if (size > PTRDIFF_MAX) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// alignment  size of memroy
+	size_t get_size = alignment(size);
+	my_print("alignment size = %lu, get_size = %lu \n", size, get_size);
+
+	if (get_size <= (SIZE_CLASS_MAX - BLOCK_HEADER))
+	{
+		int zero;
+		return pool_alloc(size_class(get_size), size, &zero);
+	} else {
+		return bulk_block(get_size, 0);
+	}
+}
+
+void *malloc(size_t size)
+{
+	return prof_hook(plain_malloc(size), size);
+}
+
+/*
+ * You must also implement calloc().  It should create allocations
+ * compatible with those created by malloc().  In particular, any
+ * allocations of a total size <= SIZE_CLASS_MAX - BLOCK_HEADER bytes
+ * (4088 with the default profile) must be pool allocated, while larger
+ * allocations are mid-size runs up to MID_MAX and use the bulk
+ * allocator past that.
+ *
+ * calloc() (see man 3 calloc) returns a cleared allocation large enough
+ * to hold nmemb elements of size size.  It is cleared by setting every
+ * byte of the allocation to 0.  You should use the function memset()
+ * for this (see man 3 memset).
+ *
+ * Memory that is known to be zero already is not cleared again: pool
+ * blocks that were never handed out since their run was mapped or
+ * dropped with madvise(), mid-size runs cut from such memory, and bulk
+ * regions freshly mapped by the kernel.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+	size_t total;
+	if (__builtin_mul_overflow(nmemb, size, &total) || total > PTRDIFF_MAX)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (total == 0)
+		return malloc(0);
+
+	size_t get_size = alignment(total);
+	void *ptr;
+	if (get_size <= (SIZE_CLASS_MAX - BLOCK_HEADER))
+	{
+		// fresh blocks carved from zeroed runs need no clearing
+		int zero;
+		ptr = pool_alloc(size_class(get_size), total, &zero);
+		if (ptr != NULL && !zero)
+			memset(ptr, 0, get_size);
+	}
+	else
+	{
+		ptr = bulk_block(get_size, 1);
+	}
+	my_print("clear mem size %lu, return %p \n", get_size, ptr);
+
+    return prof_hook(ptr, total);
+}
+
+/*
+ * You must also implement realloc().  It should create allocations
+ * compatible with those created by malloc(), honoring the pool
+ * alocation and bulk allocation rules.  It must move data from the
+ * previously-allocated block to the newly-allocated block if it cannot
+ * resize the given block directly.  See man 3 realloc for more
+ * information on what this means.
+ *
+ * Pool blocks are kept when the new size falls in the same class,
+ * mid-size runs are resized in place when the chunks after them are
+ * free, and bulk regions are resized with mremap().  Anything else is
+ * copied straight into a new block.
+ */
+void *realloc(void *ptr, size_t size)
+{
+	// before alignment(), which wraps the largest sizes around to 0; also
+	// keeps the header from wrapping the new sizes below around
+	if (size > PTRDIFF_MAX)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	size_t get_size = alignment(size);
+	if (ptr == NULL)
+	{
+		return malloc(get_size);
+	}
+	if (get_size == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+
+	void *origin = aligned_origin(ptr);
+	int index = ptr_class(origin);
+	HARDEN_CHECK(!get_chunk_free_flag(origin - sizeof(size_t)), "realloc of freed block", ptr);
+	HARDEN_BLOCK(origin, index);
+	size_t block_size = usable_size(origin) - (ptr - origin);
+	my_print(" realloc mem size %lu, get_size %lu, block_size %lu \n", size, get_size, block_size);
+	// blocks cut for an aligned allocation are always copied
+	if (origin == ptr && index >= 0)
+	{
+		// keep the block while the new size maps to its class, so that
+		// free_sized() with the new size still finds the class
+		if (get_size <= SIZE_CLASS_MAX - BLOCK_HEADER && size_class(get_size) == index)
+		{
+			my_print("realloc in place %p \n", ptr);
+			return ptr;
+		}
+	}
+	else if (origin == ptr && get_size > SIZE_CLASS_MAX - BLOCK_HEADER &&
+			 get_chunk_size(ptr - sizeof(size_t)) <= MID_MAX)
+	{
+		BulkNode *block = ptr - sizeof(size_t);
+		size_t old_size = get_chunk_size(&block->header);
+		size_t new_size = get_size + sizeof(size_t);
+		if (new_size <= MID_MAX && mid_resize(block, new_size) == 0)
+		{
+			if (gProfOn)
+				prof_unsample(ptr, index);
+			TCache *tc = tcache_get();
+			STATS_ADD(tc, midBytes, new_size);
+			STATS_ADD(tc, midFreedBytes, old_size);
+			SET_HEADER(block, new_size);
+			set_chunk_alloc_flag(&block->header);
+			my_print("realloc run %p size %lu \n", block, new_size);
+			return ptr;
+		}
+	}
+	else if (origin == ptr && get_size + sizeof(size_t) > MID_MAX)
+	{
+		// resize the mapping itself; the kernel moves it only if the
+		// pages after it are taken
+		BulkNode *block = ptr - sizeof(size_t);
+		size_t old_size = get_chunk_size(&block->header);
+		size_t new_size = get_size + sizeof(size_t);
+		if (gProfOn)
+			prof_unsample(ptr, index);
+		BulkNode *newptr = bulk_realloc(block, old_size, new_size);
+		if (newptr == NULL)
+			return NULL;
+		TCache *tc = tcache_get();
+		STATS_ADD(tc, bulkBytes, new_size);
+		STATS_ADD(tc, bulkFreedBytes, old_size);
+		SET_HEADER(newptr, new_size);
+		set_chunk_alloc_flag(&newptr->header);
+		my_print("realloc mapping %p -> %p size %lu \n", block, newptr, new_size);
+		return newptr->data;
+	}
+
+	void *newPtr = malloc(get_size);
+	if (newPtr == NULL)
+		return NULL;
+	memcpy(newPtr, ptr, block_size < get_size ? block_size : get_size);
+	free(ptr);
+	return newPtr;
+}
+
+/*
+ * Returns a pool block of class index to the thread cache, or straight
+ * to its arena once the thread's cache is gone.  Reads nothing from the
+ * block itself.
+ */
+static void pool_free(MemNode *block, int index)
+{
+	my_print("free mem: %p and size %lu \n", block->data, class_size(index));
+	TCache *tc = tcache_get();
+	STATS_ADD(tc, frees[index], 1);
+	Arena *arena = block_superblock(block)->arena;
+	if (arena != gThreadArena) {
+		remote_free(arena, block);
+		return;
+	}
+	if (tc == NULL) {
+		pthread_mutex_lock(&arena->lock);
+		arena_free_block(arena, block);
+		arena_tick(arena);
+		pthread_mutex_unlock(&arena->lock);
+		return;
+	}
+	LINK_SET(block, tc->bins[index]);
+	tc->bins[index] = block;
+	if (++tc->count[index] > TCACHE_MAX)
+		tcache_flush(tc, index, TCACHE_MAX - TCACHE_BATCH);
+}
+
+/*
+ * You should implement a free() that can successfully free a region of
+ * memory allocated by any of the above allocation routines, whether it
+ * is a pool- or bulk-allocated region.
+ *
+ * The given implementation does nothing.
+ */
+void free(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	ptr = aligned_origin(ptr);
+	int index = ptr_class(ptr);
+	if (index < 0) {
+		BulkNode *block = ptr - sizeof(size_t);
+		HARDEN_CHECK(!get_chunk_free_flag(&block->header), "double free", ptr);
+		HARDEN_BLOCK(ptr, index);
+		if (get_chunk_free_flag(&block->header))
+			return;
+		set_chunk_free_flag(&block->header);
+		if (gProfOn)
+			prof_unsample(ptr, index);
+		my_print("free mem: %p and size %lu \n", ptr, block->header);
+		TCache *tc = tcache_get();
+		if (get_chunk_size(&block->header) <= MID_MAX) {
+			STATS_ADD(tc, midFrees, 1);
+			STATS_ADD(tc, midFreedBytes, get_chunk_size(&block->header));
+			mid_free(block);
+			return;
+		}
+		STATS_ADD(tc, bulkFrees, 1);
+		STATS_ADD(tc, bulkFreedBytes, get_chunk_size(&block->header));
+		bulk_free(block, get_chunk_size(&block->header));
+		return;
+	}
+
+	MemNode *block = ptr - BLOCK_HEADER;
+#ifndef MM_HEADERLESS
+	HARDEN_CHECK(!get_chunk_free_flag(&block->header), "double free", ptr);
+	HARDEN_BLOCK(ptr, index);
+	if (get_chunk_free_flag(&block->header))
+		return;
+	set_chunk_free_flag(&block->header);
+#endif
+	if (gProfOn)
+		prof_unsample(ptr, index);
+	pool_free(block, index);
+}
+
+/*
+ * Returns the smallest class holding size bytes whose blocks are all
+ * aligned to align, or -1 if there is none.  Only the headerless build
+ * has naturally aligned pool blocks; in the default build the header
+ * sits in front of the data.
+ */
+static int aligned_class(size_t align, size_t size)
+{
+#ifdef MM_HEADERLESS
+	size_t get_size = alignment(size);
+	if (align <= CHUNK_SIZE && get_size <= SIZE_CLASS_MAX)
+	{
+		for (int index = size_class(get_size); index < NCLASSES; index++)
+		{
+			if (class_size(index) % align == 0)
+				return index;
+		}
+	}
+#endif
+	return -1;
+}
+
+/*
+ * Allocates size bytes aligned to align, a power of two.  Pool blocks
+ * are naturally aligned to the largest power of two dividing their
+ * class size (runs start on a chunk boundary), so in the headerless
+ * build a class that is a multiple of align serves the request directly.
+ * Otherwise the block is over-allocated by align bytes and the aligned
+ * pointer is cut from it; alignments past the pool classes end up on the
+ * bulk path that way.
+ */
+static void *aligned_malloc(size_t align, size_t size)
+{
+	if (align <= 8)
+		return malloc(size);
+	if (size == 0)
+		size = 1;
+	if (size > PTRDIFF_MAX - align)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	int index = aligned_class(align, size);
+	if (index >= 0)
+	{
+		int zero;
+		return prof_hook(pool_alloc(index, size, &zero), size);
+	}
+#ifdef MM_HEADERLESS
+	// cut from a bulk block, so that the flag word is never looked for
+	// in front of a pool block
+	char *data = bulk_block(alignment(size + align), 0);
+#else
+	char *data = plain_malloc(size + align - sizeof(size_t));
+#endif
+	if (data == NULL)
+		return NULL;
+	char *ptr = (char *)(((uintptr_t)data + align - 1) & ~(uintptr_t)(align - 1));
+	if (ptr != data)
+		*(size_t *)(ptr - sizeof(size_t)) = (ptr - data) | CHUNK_ALIGNED | 0x1;
+	my_print("aligned alloc %lu at %lu: block %p, return %p \n", size, align, data, ptr);
+	return prof_hook(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+	if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+		return EINVAL;
+	void *ptr = aligned_malloc(align, size);
+	if (ptr == NULL)
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+	if (align == 0 || (align & (align - 1)) != 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	return aligned_malloc(align, size);
+}
+
+void *memalign(size_t align, size_t size)
+{
+	return aligned_alloc(align, size);
+}
+
+void *valloc(size_t size)
+{
+	return aligned_malloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	if (size > PTRDIFF_MAX - page)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	return aligned_malloc(page, (size + page - 1) & ~(page - 1));
+}
+
+/* Returns the number of bytes usable at ptr, which may be more than
+ * were asked for: the rest of the block's size class. */
+size_t malloc_usable_size(void *ptr)
+{
+	if (ptr == NULL)
+		return 0;
+	void *origin = aligned_origin(ptr);
+	return usable_size(origin) - (ptr - origin);
+}
+
+/*
+ * Allocates n blocks of size bytes into out and returns how many were
+ * allocated, which is less than n only if memory ran out.  Pool blocks
+ * come from the thread cache first and then from the arena under a
+ * single lock: whole free lists are taken and fresh blocks carved in
+ * sequence, so each block costs little more than the store into out.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+	size_t get_size = alignment(size);
+	size_t done = 0;
+	if (size == 0)
+		return 0;
+	if (size > PTRDIFF_MAX)
+	{
+		errno = ENOMEM;
+		return 0;
+	}
+	if (get_size > SIZE_CLASS_MAX - BLOCK_HEADER)
+	{
+		while (done < n && (out[done] = bulk_block(get_size, 0)) != NULL)
+			done++;
+		return done;
+	}
+
+	int index = size_class(get_size);
+	TCache *tc = tcache_get();
+	MemNode *block;
+	if (tc != NULL)
+	{
+		while (done < n && (block = tc->bins[index]) != NULL)
+		{
+			tc->bins[index] = LINK_GET(block);
+			tc->count[index]--;
+#ifndef MM_HEADERLESS
+			set_chunk_alloc_flag(&block->header);
+#endif
+			out[done++] = block->data;
+		}
+	}
+	if (done == n)
+	{
+		STATS_ADD(tc, allocs[index], done);
+		STATS_ADD(tc, requested, done * size);
+		return done;
+	}
+
+	Arena *arena = thread_arena();
+	pthread_mutex_lock(&arena->lock);
+	remote_drain(arena);
+	while (done < n)
+	{
+		ChunkDesc *cd = arena->pools.chunkList[index];
+		if (cd == NULL && (cd = arena_chunk(arena, index)) == NULL)
+			break;
+		// empty this run before moving on to the next
+		while (done < n && cd->listed)
+		{
+			block = chunk_take(arena, cd, NULL);
+#ifndef MM_HEADERLESS
+			set_chunk_alloc_flag(&block->header);
+#endif
+			out[done++] = block->data;
+		}
+	}
+	pthread_mutex_unlock(&arena->lock);
+	STATS_ADD(tc, allocs[index], done);
+	STATS_ADD(tc, requested, done * size);
+	my_print("batch alloc %lu of size %lu, got %lu \n", n, size, done);
+	return done;
+}
+
+/*
+ * Frees the n blocks in ptrs, which may be of any size and need not come
+ * from mm_malloc_batch().  Pool blocks of the thread's arena fill the
+ * thread cache; once it is full, the rest go back to the arena under one
+ * lock acquisition.  Blocks of other arenas go on their remote lists.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+	TCache *tc = tcache_get();
+	Arena *locked = NULL;
+	for (size_t i = 0; i < n; i++)
+	{
+		if (ptrs[i] == NULL)
+			continue;
+		void *ptr = aligned_origin(ptrs[i]);
+		int index = ptr_class(ptr);
+		if (index < 0)
+		{
+			free(ptr);
+			continue;
+		}
+		MemNode *block = ptr - BLOCK_HEADER;
+#ifndef MM_HEADERLESS
+		HARDEN_CHECK(!get_chunk_free_flag(&block->header), "double free", ptr);
+		HARDEN_BLOCK(ptr, index);
+		if (get_chunk_free_flag(&block->header))
+			continue;
+		set_chunk_free_flag(&block->header);
+#endif
+		if (gProfOn)
+			prof_unsample(ptr, index);
+		STATS_ADD(tc, frees[index], 1);
+		Arena *arena = block_superblock(block)->arena;
+		if (arena != gThreadArena)
+		{
+			remote_free(arena, block);
+			continue;
+		}
+		if (tc != NULL && tc->count[index] < TCACHE_MAX)
+		{
+			LINK_SET(block, tc->bins[index]);
+			tc->bins[index] = block;
+			tc->count[index]++;
+			continue;
+		}
+		if (arena != locked)
+		{
+			if (locked != NULL)
+				pthread_mutex_unlock(&locked->lock);
+			pthread_mutex_lock(&arena->lock);
+			locked = arena;
+		}
+		arena_free_block(arena, block);
+	}
+	if (locked != NULL)
+	{
+		arena_tick(locked);
+		pthread_mutex_unlock(&locked->lock);
+	}
+}
+
+/*
+ * Object caches.  A cache hands out objects of one size from slabs of
+ * its own: runs of chunks taken from the arenas' free runs like the
+ * runs of the size classes, but packed with objects of exactly the
+ * cache's size, rounded up to its alignment, and without headers.  The
+ * run length is picked so that a slab holds at least SLAB_MIN_OBJS
+ * objects and wastes at most a sixteenth of its bytes where it can.
+ *
+ * Each thread keeps a magazine of up to MAG_SIZE free objects per cache
+ * in front of the slabs, so that mm_cache_alloc() and mm_cache_free()
+ * usually take no lock; an empty magazine is refilled and a full one
+ * drained MAG_SIZE / 2 objects at a time under the cache lock.  The
+ * magazines are kept with the thread's counter record and pass with it
+ * to the next thread, like the counters.  Caches are numbered, and a
+ * magazine belongs to the cache whose number and generation it carries,
+ * so one left over from a destroyed cache is emptied when the number is
+ * reused.
+ *
+ * Slabs with free or uncarved objects are on the cache's partial list,
+ * the others on its full list.  A slab that empties goes back to its
+ * arena unless it is the only partial one.
+ */
+#define SLAB_MIN_OBJS 8
+#define SLAB_MAX_ORDER \
+	(SUPERBLOCK_SHIFT - CHUNK_SHIFT - 1 < 7 ? SUPERBLOCK_SHIFT - CHUNK_SHIFT - 1 : 7)
+
+struct mm_cache {
+	pthread_mutex_t lock;
+	unsigned int id;
+	unsigned int gen;
+	size_t size;
+	int order;
+	unsigned int slabObjs;
+	ChunkDesc *partial;
+	ChunkDesc *full;
+	size_t slabs;
+	/* Made without a magazine, during thread teardown. */
+	size_t allocs;
+	size_t frees;
+};
+
+static pthread_mutex_t gCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static struct mm_cache *gCaches[MAX_CACHES];
+static unsigned int gCacheGen[MAX_CACHES];
+
+static void cache_fork_prepare(void)
+{
+	pthread_mutex_lock(&gCacheLock);
+	for (int i = 0; i < MAX_CACHES; i++) {
+		if (gCaches[i] != NULL)
+			pthread_mutex_lock(&gCaches[i]->lock);
+	}
+}
+
+static void cache_fork_parent(void)
+{
+	for (int i = 0; i < MAX_CACHES; i++) {
+		if (gCaches[i] != NULL)
+			pthread_mutex_unlock(&gCaches[i]->lock);
+	}
+	pthread_mutex_unlock(&gCacheLock);
+}
+
+static void cache_fork_child(void)
+{
+	for (int i = 0; i < MAX_CACHES; i++) {
+		if (gCaches[i] != NULL)
+			pthread_mutex_init(&gCaches[i]->lock, NULL);
+	}
+	pthread_mutex_init(&gCacheLock, NULL);
+}
+
+static void slab_link(ChunkDesc **list, ChunkDesc *cd)
+{
+	cd->prev = NULL;
+	cd->next = *list;
+	if (*list != NULL)
+		(*list)->prev = cd;
+	*list = cd;
+}
+
+static void slab_unlink(ChunkDesc **list, ChunkDesc *cd)
+{
+	if (cd->prev != NULL)
+		cd->prev->next = cd->next;
+	else
+		*list = cd->next;
+	if (cd->next != NULL)
+		cd->next->prev = cd->prev;
+}
+
+/* Takes a run for a new slab from the calling thread's arena and lists
+ * it as partial.  Must be called with the cache lock held. */
+static ChunkDesc *slab_create(struct mm_cache *cache)
+{
+	Arena *arena = thread_arena();
+	pthread_mutex_lock(&arena->lock);
+	ChunkDesc *cd = run_alloc(arena, (size_t)1 << cache->order, CHUNK_CACHE);
+	pthread_mutex_unlock(&arena->lock);
+	if (cd == NULL)
+		return NULL;
+	cd->free = NULL;
+	cd->live = 0;
+	cd->carved = 0;
+	cd->listed = 1;
+	slab_link(&cache->partial, cd);
+	cache->slabs++;
+	return cd;
+}
+
+/* Hands the run of a slab back to the arena it came from.  The slab must
+ * already be off the cache's lists. */
+static void slab_release(struct mm_cache *cache, ChunkDesc *cd)
+{
+	Arena *arena = block_superblock(cd)->arena;
+	pthread_mutex_lock(&arena->lock);
+	run_free(arena, cd);
+	pthread_mutex_unlock(&arena->lock);
+	cache->slabs--;
+}
+
+/* Takes one object off a partial slab, creating a slab if there is
+ * none.  Must be called with the cache lock held. */
+static void *slab_take(struct mm_cache *cache)
+{
+	ChunkDesc *cd = cache->partial;
+	if (cd == NULL && (cd = slab_create(cache)) == NULL)
+		return NULL;
+	void *obj = cd->free;
+	if (obj != NULL)
+		cd->free = *(MemNode **)obj;
+	else
+		obj = chunk_base(cd) + cd->carved++ * cache->size;
+	cd->live++;
+	if (cd->free == NULL && cd->carved == cache->slabObjs) {
+		slab_unlink(&cache->partial, cd);
+		slab_link(&cache->full, cd);
+		cd->listed = 0;
+	}
+	return obj;
+}
+
+/* Puts an object back on its slab.  Must be called with the cache lock
+ * held. */
+static void slab_put(struct mm_cache *cache, void *obj)
+{
+	ChunkDesc *cd = block_chunk(obj);
+	*(MemNode **)obj = cd->free;
+	cd->free = obj;
+	cd->live--;
+	if (!cd->listed) {
+		slab_unlink(&cache->full, cd);
+		slab_link(&cache->partial, cd);
+		cd->listed = 1;
+	}
+	if (cd->live == 0 && (cd->prev != NULL || cd->next != NULL)) {
+		slab_unlink(&cache->partial, cd);
+		slab_release(cache, cd);
+	}
+}
+
+/* Returns the calling thread's magazine for cache, or NULL while the
+ * thread is being torn down. */
+static Magazine *cache_magazine(struct mm_cache *cache)
+{
+	TCache *tc = tcache_get();
+	if (tc == NULL || tc->stats == NULL)
+		return NULL;
+	Magazine *mags = tc->stats->mags;
+	if (mags == NULL) {
+		mags = mmap(NULL, sizeof(Magazine) * MAX_CACHES, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		COUNT_CALL(mmap);
+		if (mags == MAP_FAILED)
+			return NULL;
+		__atomic_store_n(&tc->stats->mags, mags, __ATOMIC_RELEASE);
+	}
+	Magazine *mag = &mags[cache->id];
+	if (mag->gen != cache->gen) {
+		// left over from a destroyed cache, whose slabs are gone
+		mag->count = 0;
+		mag->allocs = 0;
+		mag->frees = 0;
+		__atomic_store_n(&mag->gen, cache->gen, __ATOMIC_RELEASE);
+	}
+	return mag;
+}
+
+struct mm_cache *mm_cache_create(size_t obj_size, size_t align)
+{
+	size_t slab_max = (size_t)CHUNK_SIZE << SLAB_MAX_ORDER;
+	if (align == 0)
+		align = sizeof(void *);
+	if ((align & (align - 1)) != 0 || align > CHUNK_SIZE || obj_size == 0 ||
+		obj_size > slab_max / SLAB_MIN_OBJS) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+	size_t size = (obj_size + align - 1) & ~(align - 1);
+
+	// the shortest run that packs well, or else the one wasting least
+	int order = -1;
+	size_t best = 0;
+	for (int k = 0; k <= SLAB_MAX_ORDER; k++) {
+		size_t slab = (size_t)CHUNK_SIZE << k;
+		size_t objs = slab / size;
+		if (objs < SLAB_MIN_OBJS || objs > USHRT_MAX)
+			continue;
+		size_t waste = (slab - objs * size) * (slab_max / slab);
+		if (order < 0 || waste < best) {
+			order = k;
+			best = waste;
+		}
+		if ((slab - objs * size) * 16 <= slab)
+			break;
+	}
+	if (order < 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	pthread_once(&gArenaOnce, arena_init);
+	struct mm_cache *cache = malloc(sizeof(*cache));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(*cache));
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->size = size;
+	cache->order = order;
+	cache->slabObjs = ((size_t)CHUNK_SIZE << order) / size;
+
+	pthread_mutex_lock(&gCacheLock);
+	unsigned int id = 0;
+	while (id < MAX_CACHES && gCaches[id] != NULL)
+		id++;
+	if (id == MAX_CACHES) {
+		pthread_mutex_unlock(&gCacheLock);
+		free(cache);
+		errno = ENOMEM;
+		return NULL;
+	}
+	cache->id = id;
+	cache->gen = ++gCacheGen[id];
+	gCaches[id] = cache;
+	pthread_mutex_unlock(&gCacheLock);
+	return cache;
+}
+
+void mm_cache_destroy(struct mm_cache *cache)
+{
+	if (cache == NULL)
+		return;
+	pthread_mutex_lock(&gCacheLock);
+	gCaches[cache->id] = NULL;
+	pthread_mutex_unlock(&gCacheLock);
+
+	// the slabs go back whatever they still hold
+	ChunkDesc *lists[2] = { cache->partial, cache->full };
+	for (int i = 0; i < 2; i++) {
+		ChunkDesc *next;
+		for (ChunkDesc *cd = lists[i]; cd != NULL; cd = next) {
+			next = cd->next;
+			slab_release(cache, cd);
+		}
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache);
+}
+
+void *mm_cache_alloc(struct mm_cache *cache)
+{
+	Magazine *mag = cache_magazine(cache);
+	if (mag != NULL && mag->count > 0) {
+		mag->allocs++;
+		return mag->objs[--mag->count];
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	void *obj = slab_take(cache);
+	if (obj != NULL) {
+		if (mag != NULL) {
+			mag->allocs++;
+			// refill the magazine for the next few allocations
+			while (mag->count < MAG_SIZE / 2) {
+				void *extra = slab_take(cache);
+				if (extra == NULL)
+					break;
+				mag->objs[mag->count++] = extra;
+			}
+		} else {
+			cache->allocs++;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+	if (obj == NULL)
+		errno = ENOMEM;
+	return obj;
+}
+
+void mm_cache_free(struct mm_cache *cache, void *obj)
+{
+	if (obj == NULL)
+		return;
+	Magazine *mag = cache_magazine(cache);
+	if (mag != NULL && mag->count < MAG_SIZE) {
+		mag->objs[mag->count++] = obj;
+		mag->frees++;
+		return;
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	if (mag != NULL) {
+		while (mag->count > MAG_SIZE / 2)
+			slab_put(cache, mag->objs[--mag->count]);
+		mag->objs[mag->count++] = obj;
+		mag->frees++;
+	} else {
+		slab_put(cache, obj);
+		cache->frees++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+int mm_cache_stats(struct mm_cache *cache, struct mm_cache_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->obj_size = cache->size;
+	stats->slab_bytes = (size_t)CHUNK_SIZE << cache->order;
+	stats->slab_objs = cache->slabObjs;
+
+	pthread_mutex_lock(&cache->lock);
+	stats->slabs = cache->slabs;
+	stats->allocs = cache->allocs;
+	stats->frees = cache->frees;
+	pthread_mutex_unlock(&cache->lock);
+
+	for (ThreadStats *st = __atomic_load_n(&gStatsList, __ATOMIC_ACQUIRE);
+		 st != NULL; st = st->next) {
+		Magazine *mags = __atomic_load_n(&st->mags, __ATOMIC_ACQUIRE);
+		if (mags == NULL)
+			continue;
+		Magazine *mag = &mags[cache->id];
+		if (__atomic_load_n(&mag->gen, __ATOMIC_ACQUIRE) != cache->gen)
+			continue;
+		stats->allocs += mag->allocs;
+		stats->frees += mag->frees;
+		stats->cached_objs += mag->count;
+	}
+	stats->live_objs = stats->allocs > stats->frees ? stats->allocs - stats->frees : 0;
+	return 0;
+}
+
+/*
+ * Regions.  A region bump-allocates from blocks of REGION_BLOCK bytes,
+ * runs of chunks taken from the arenas like slabs, and frees everything
+ * at once.  The region's own header lives at the start of its first
+ * block.  A request larger than REGION_LARGE gets a bulk_alloc()
+ * mapping of its own instead, so that it does not waste the rest of a
+ * block.
+ *
+ * mm_region_reset() keeps the blocks for the next round: the first
+ * becomes current again and the others are spliced onto the spare list
+ * in one step, so reset takes constant time whatever was allocated; only
+ * the oversized mappings are freed one by one.  The blocks go back to
+ * their arenas when the region is destroyed.
+ */
+#define REGION_SHIFT 16
+#define REGION_ORDER (REGION_SHIFT > CHUNK_SHIFT ? REGION_SHIFT - CHUNK_SHIFT : 0)
+#define REGION_BLOCK ((size_t)CHUNK_SIZE << REGION_ORDER)
+#define REGION_LARGE (REGION_BLOCK / 4)
+#define REGION_ALIGN 16
+
+typedef struct RegionBlock {
+	struct RegionBlock *next;
+	size_t size;
+} RegionBlock;
+
+struct mm_region {
+	char *cur;
+	char *end;
+	RegionBlock *first;
+	RegionBlock *blocks;      /* after the first, newest first */
+	RegionBlock *blocksLast;
+	RegionBlock *spare;
+	RegionBlock *large;
+};
+
+#define REGION_HEADER(type) \
+	((sizeof(type) + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1))
+
+/* Takes a run for a region block from the calling thread's arena. */
+static RegionBlock *region_block_create(void)
+{
+	Arena *arena = thread_arena();
+	pthread_mutex_lock(&arena->lock);
+	ChunkDesc *cd = run_alloc(arena, (size_t)1 << REGION_ORDER, CHUNK_REGION);
+	pthread_mutex_unlock(&arena->lock);
+	if (cd == NULL)
+		return NULL;
+	RegionBlock *block = (RegionBlock *)chunk_base(cd);
+	block->size = REGION_BLOCK;
+	return block;
+}
+
+static void region_block_release(RegionBlock *block)
+{
+	ChunkDesc *cd = block_chunk(block);
+	Arena *arena = block_superblock(cd)->arena;
+	pthread_mutex_lock(&arena->lock);
+	run_free(arena, cd);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+/* Frees the region's oversized allocations. */
+static void region_free_large(struct mm_region *region)
+{
+	RegionBlock *next;
+	for (RegionBlock *block = region->large; block != NULL; block = next) {
+		next = block->next;
+		bulk_free(block, block->size);
+	}
+	region->large = NULL;
+}
+
+struct mm_region *mm_region_create(void)
+{
+	RegionBlock *block = region_block_create();
+	if (block == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	struct mm_region *region = (struct mm_region *)((char *)block + REGION_HEADER(RegionBlock));
+	memset(region, 0, sizeof(*region));
+	region->first = block;
+	mm_region_reset(region);
+	return region;
+}
+
+void *mm_region_alloc(struct mm_region *region, size_t size)
+{
+	if (size > REGION_LARGE) {
+		if (size > PTRDIFF_MAX - REGION_HEADER(RegionBlock)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		size_t length = size + REGION_HEADER(RegionBlock);
+		RegionBlock *block = bulk_alloc(length);
+		if (block == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		block->size = length;
+		block->next = region->large;
+		region->large = block;
+		return (char *)block + REGION_HEADER(RegionBlock);
+	}
+
+	size = size == 0 ? REGION_ALIGN : (size + REGION_ALIGN - 1) & ~(size_t)(REGION_ALIGN - 1);
+	if ((size_t)(region->end - region->cur) < size) {
+		RegionBlock *block = region->spare;
+		if (block != NULL)
+			region->spare = block->next;
+		else if ((block = region_block_create()) == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+		block->next = region->blocks;
+		if (region->blocks == NULL)
+			region->blocksLast = block;
+		region->blocks = block;
+		region->cur = (char *)block + REGION_HEADER(RegionBlock);
+		region->end = (char *)block + block->size;
+	}
+	void *ptr = region->cur;
+	region->cur += size;
+	return ptr;
+}
+
+void mm_region_reset(struct mm_region *region)
+{
+	region_free_large(region);
+	if (region->blocks != NULL) {
+		region->blocksLast->next = region->spare;
+		region->spare = region->blocks;
+		region->blocks = NULL;
+	}
+	region->cur = (char *)region + REGION_HEADER(struct mm_region);
+	region->end = (char *)region->first + region->first->size;
+}
+
+void mm_region_destroy(struct mm_region *region)
+{
+	if (region == NULL)
+		return;
+	region_free_large(region);
+	RegionBlock *lists[2] = { region->blocks, region->spare };
+	for (int i = 0; i < 2; i++) {
+		RegionBlock *next;
+		for (RegionBlock *block = lists[i]; block != NULL; block = next) {
+			next = block->next;
+			region_block_release(block);
+		}
+	}
+	region_block_release(region->first);
+}
+
+#ifdef MM_DEBUG
+/* Aborts unless ptr is a live pool block of class index. */
+static void sized_check(void *ptr, int index)
+{
+	int actual = ptr_class(aligned_origin(ptr));
+	if (aligned_origin(ptr) != ptr || actual != index)
+	{
+		fprintf(stderr, "mm: sized free of %p: size is for class %d, block is %d\n",
+				ptr, index, actual);
+		abort();
+	}
+#ifndef MM_HEADERLESS
+	MemNode *block = ptr - BLOCK_HEADER;
+	if (get_chunk_free_flag(&block->header))
+	{
+		fprintf(stderr, "mm: sized free of %p: block is not allocated\n", ptr);
+		abort();
+	}
+#endif
+}
+#endif
+
+/*
+ * Frees a pool block whose class follows from the size the caller
+ * passed, without reading the block's header or the page map.  The
+ * block's free-flag is left as it is, so these entry points skip the
+ * double-free check that free() makes; MM_DEBUG builds check the size
+ * and the flag against the header instead, and the hardened build makes
+ * the checks free() makes.
+ */
+static void sized_free(void *ptr, int index)
+{
+#ifdef MM_DEBUG
+	sized_check(ptr, index);
+#endif
+#ifdef MM_HARDENED
+	MemNode *block = ptr - BLOCK_HEADER;
+	HARDEN_CHECK(!get_chunk_free_flag(&block->header), "double free", ptr);
+	harden_check(ptr, index);
+	set_chunk_free_flag(&block->header);
+#endif
+	if (gProfOn)
+		prof_unsample(ptr, index);
+	pool_free(ptr - BLOCK_HEADER, index);
+}
+
+/* C23: frees ptr, which malloc(), calloc() or realloc() returned for a
+ * request of size bytes. */
+void free_sized(void *ptr, size_t size)
+{
+	size_t get_size = alignment(size);
+	if (ptr == NULL)
+		return;
+	if (size == 0 || get_size > SIZE_CLASS_MAX - BLOCK_HEADER)
+	{
+		free(ptr);
+		return;
+	}
+	sized_free(ptr, size_class(get_size));
+}
+
+/* C23: frees ptr, which aligned_alloc() returned for a request of size
+ * bytes aligned to align. */
+void free_aligned_sized(void *ptr, size_t align, size_t size)
+{
+	if (ptr == NULL)
+		return;
+	if (align <= 8)
+	{
+		free_sized(ptr, size);
+		return;
+	}
+	int index = aligned_class(align, size == 0 ? 1 : size);
+	if (index < 0)
+	{
+		free(ptr);
+		return;
+	}
+	sized_free(ptr, index);
+}
+
+/* Adds the counts of one ThreadStats record to stats. */
+static void stats_sum(struct mm_stats *stats, ThreadStats *st)
+{
+	for (int i = 0; i < NCLASSES; i++) {
+		stats->classes[i].allocs += __atomic_load_n(&st->allocs[i], __ATOMIC_RELAXED);
+		stats->classes[i].frees += __atomic_load_n(&st->frees[i], __ATOMIC_RELAXED);
+	}
+	stats->requested_bytes += __atomic_load_n(&st->requested, __ATOMIC_RELAXED);
+	stats->mid_allocs += __atomic_load_n(&st->midAllocs, __ATOMIC_RELAXED);
+	stats->mid_frees += __atomic_load_n(&st->midFrees, __ATOMIC_RELAXED);
+	stats->mid_live_bytes += __atomic_load_n(&st->midBytes, __ATOMIC_RELAXED);
+	stats->mid_live_bytes -= __atomic_load_n(&st->midFreedBytes, __ATOMIC_RELAXED);
+	stats->bulk_allocs += __atomic_load_n(&st->bulkAllocs, __ATOMIC_RELAXED);
+	stats->bulk_frees += __atomic_load_n(&st->bulkFrees, __ATOMIC_RELAXED);
+	stats->bulk_live_bytes += __atomic_load_n(&st->bulkBytes, __ATOMIC_RELAXED);
+	stats->bulk_live_bytes -= __atomic_load_n(&st->bulkFreedBytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sums the per-thread counters and the arena and bulk figures.  Takes no
+ * locks, so that it can run from a signal handler: per-thread counts are
+ * read while their threads may still be adding to them.
+ */
+int mm_stats(struct mm_stats *stats)
+{
+	size_t blocks[NCLASSES] = { 0 };
+	memset(stats, 0, sizeof(*stats));
+	stats->nclasses = NCLASSES;
+
+	for (unsigned int a = 0; a < __atomic_load_n(&gArenaCount, __ATOMIC_ACQUIRE); a++)
+		for (int i = 0; i < NCLASSES; i++)
+			blocks[i] += __atomic_load_n(&gArenas[a].blocks[i], __ATOMIC_RELAXED);
+
+	stats_sum(stats, &gStatsShared);
+	for (ThreadStats *st = __atomic_load_n(&gStatsList, __ATOMIC_ACQUIRE);
+		 st != NULL; st = st->next)
+		stats_sum(stats, st);
+
+	for (int i = 0; i < NCLASSES; i++) {
+		struct mm_class_stats *cs = &stats->classes[i];
+		cs->size = class_size(i);
+		// a block freed by another thread may be counted before its
+		// allocation is
+		cs->live_blocks = cs->allocs > cs->frees ? cs->allocs - cs->frees : 0;
+		cs->free_blocks = blocks[i] > cs->live_blocks ? blocks[i] - cs->live_blocks : 0;
+		stats->allocated_bytes += cs->allocs * cs->size;
+		stats->live_bytes += cs->live_blocks * cs->size;
+	}
+	stats->reserved_bytes = __atomic_load_n(&gPoolCalls.superblocks, __ATOMIC_RELAXED)
+		* (size_t)SUPERBLOCK_SIZE;
+	stats->mmap_calls = __atomic_load_n(&gPoolCalls.mmap, __ATOMIC_RELAXED);
+	stats->munmap_calls = __atomic_load_n(&gPoolCalls.munmap, __ATOMIC_RELAXED);
+	stats->madvise_calls = __atomic_load_n(&gPoolCalls.madvise, __ATOMIC_RELAXED);
+	bulk_stats(stats);
+	return 0;
+}
+
+/* Appends s to the line at buf + *len, right-aligned in a field of
+ * width characters. */
+static void stats_put(char *buf, size_t *len, const char *s, int width)
+{
+	int n = 0;
+	while (s[n] != '\0')
+		n++;
+	for (; width > n; width--)
+		buf[(*len)++] = ' ';
+	for (int i = 0; i < n; i++)
+		buf[(*len)++] = s[i];
+}
+
+/* Appends value in decimal, as stats_put() does a string. */
+static void stats_put_num(char *buf, size_t *len, size_t value, int width)
+{
+	char digits[24];
+	int n = sizeof(digits) - 1;
+	digits[n] = '\0';
+	do {
+		digits[--n] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+	stats_put(buf, len, digits + n, width);
+}
+
+/* Writes a totals line: prefix, then each label followed by its value,
+ * then suffix. */
+static void stats_line(const char *prefix, const char *const *labels, const size_t *values,
+					   int count, const char *suffix)
+{
+	char buf[256];
+	size_t len = 0;
+	stats_put(buf, &len, prefix, 0);
+	for (int i = 0; i < count; i++) {
+		stats_put(buf, &len, " ", 0);
+		stats_put(buf, &len, labels[i], 0);
+		stats_put(buf, &len, " ", 0);
+		stats_put_num(buf, &len, values[i], 0);
+	}
+	stats_put(buf, &len, suffix, 0);
+	stats_put(buf, &len, "\n", 0);
+	write(2, buf, len);
+}
+
+/*
+ * Prints the statistics to stderr, one line per size class in use and a
+ * few totals.  Formats into a buffer on the stack by hand, since the
+ * printf() family is not async-signal-safe, and writes it with write(),
+ * so it neither allocates nor takes the stdio lock and can be called
+ * from a signal handler.
+ */
+void malloc_stats(void)
+{
+	static const char *const columns[] = { "class", "size", "live", "free", "allocs", "frees" };
+	static const int widths[] = { 5, 6, 12, 12, 14, 14 };
+	struct mm_stats stats;
+	char buf[256];
+	size_t len = 0;
+
+	mm_stats(&stats);
+	for (int c = 0; c < 6; c++) {
+		stats_put(buf, &len, c > 0 ? " " : "", 0);
+		stats_put(buf, &len, columns[c], widths[c]);
+	}
+	stats_put(buf, &len, "\n", 0);
+	write(2, buf, len);
+	for (size_t i = 0; i < stats.nclasses; i++) {
+		struct mm_class_stats *cs = &stats.classes[i];
+		if (cs->allocs == 0 && cs->free_blocks == 0)
+			continue;
+		size_t values[] = { i, cs->size, cs->live_blocks, cs->free_blocks, cs->allocs, cs->frees };
+		len = 0;
+		for (int c = 0; c < 6; c++) {
+			stats_put(buf, &len, c > 0 ? " " : "", 0);
+			stats_put_num(buf, &len, values[c], widths[c]);
+		}
+		stats_put(buf, &len, "\n", 0);
+		write(2, buf, len);
+	}
+	stats_line("pool:", (const char *const[]){ "requested", "allocated", "live", "reserved" },
+			   (size_t[]){ stats.requested_bytes, stats.allocated_bytes, stats.live_bytes,
+						   stats.reserved_bytes }, 4, " bytes");
+	stats_line("mid:", (const char *const[]){ "allocs", "frees", "live" },
+			   (size_t[]){ stats.mid_allocs, stats.mid_frees, stats.mid_live_bytes }, 3, " bytes");
+	stats_line("bulk:", (const char *const[]){ "allocs", "frees", "live", "cached" },
+			   (size_t[]){ stats.bulk_allocs, stats.bulk_frees, stats.bulk_live_bytes,
+						   stats.bulk_cached_bytes }, 4, " bytes");
+	stats_line("calls:", (const char *const[]){ "mmap", "munmap", "mremap", "madvise" },
+			   (size_t[]){ stats.mmap_calls, stats.munmap_calls, stats.mremap_calls,
+						   stats.madvise_calls }, 4, "");
+}
+
+/*
+ * Hands all the free memory the allocator holds back to the OS right
+ * away: the calling thread's cache is flushed, every arena takes back
+ * its remote frees and purges its free runs and empty superblocks, and
+ * the cache of freed bulk mappings is emptied.
+ */
+size_t mm_trim(void)
+{
+	size_t released = 0;
+	if (gTCacheState == TCACHE_ACTIVE) {
+		for (int i = 0; i < NCLASSES; i++) {
+			if (gTCache.count[i] > 0)
+				tcache_flush(&gTCache, i, 0);
+		}
+	}
+	pthread_once(&gArenaOnce, arena_init);
+	unsigned int now = decay_clock();
+	for (unsigned int i = 0; i < gArenaCount; i++) {
+		pthread_mutex_lock(&gArenas[i].lock);
+		remote_drain(&gArenas[i]);
+		released += arena_decay(&gArenas[i], now, 0);
+		pthread_mutex_unlock(&gArenas[i].lock);
+	}
+	return released + bulk_trim(1);
+}
+
+int mm_numa_node(void *ptr)
+{
+	Superblock *sb = pagemap_lookup(ptr);
+	if (sb == NULL)
+		return -1;
+	return numa_node_id(sb->arena->node);
+}
+
+/* glibc's interface to mm_trim().  pad is ignored: nothing is kept. */
+int malloc_trim(size_t pad)
+{
+	return mm_trim() > 0;
 }
@@ -0,0 +1,171 @@
+#ifndef MM_H
+#define MM_H
+
+#include <stddef.h>
+
+/*
+ * Extensions to the standard allocation interface provided by
+ * libcsemalloc.so.  Programs that use them must be linked against the
+ * library (or look the symbols up with dlsym()) rather than relying on
+ * LD_PRELOAD alone.
+ */
+
+/*
+ * Huge page usage of the allocator.  Mappings of at least
+ * MM_HUGEPAGE_THRESHOLD bytes (bulk allocations and pool superblocks)
+ * are aligned to 2 MB and backed by huge pages when the system allows
+ * it; the policy is off when the variable is unset or 0.
+ *
+ * The first four fields count the bytes mapped under the policy since
+ * start-up, by how they were backed: from the hugetlbfs pool with
+ * MAP_HUGETLB, advised for transparent huge pages with
+ * madvise(MADV_HUGEPAGE), or left on small pages because neither
+ * worked.  The last two are read from the kernel and give the memory of
+ * the process that is resident in huge pages right now.
+ */
+struct mm_huge_stats {
+	size_t requested_bytes;
+	size_t hugetlb_bytes;
+	size_t advised_bytes;
+	size_t fallback_bytes;
+	size_t anon_huge_resident;
+	size_t hugetlb_resident;
+};
+
+/* Fills in stats.  Returns 0, or -1 if the kernel counters could not be
+ * read, in which case the resident fields are left at 0. */
+int mm_huge_stats(struct mm_huge_stats *stats);
+
+/*
+ * Allocator statistics, summed over all threads.  Counts are cumulative
+ * since start-up; the live and free figures are derived from them and
+ * may be slightly off while other threads are allocating.
+ */
+#define MM_STATS_CLASSES 64
+
+struct mm_class_stats {
+	size_t size;          /* block size of the class */
+	size_t live_blocks;   /* blocks allocated and not yet freed */
+	size_t free_blocks;   /* other blocks in runs of the class */
+	size_t allocs;
+	size_t frees;
+};
+
+struct mm_stats {
+	size_t nclasses;
+	struct mm_class_stats classes[MM_STATS_CLASSES];
+
+	size_t requested_bytes;   /* asked for in pool allocations */
+	size_t allocated_bytes;   /* handed out for them, in whole blocks */
+	size_t live_bytes;        /* in live pool blocks */
+	size_t reserved_bytes;    /* in superblocks mapped for the pools */
+
+	/* Allocations past the size classes up to 1 MB, served from runs
+	 * of pages in the pools. */
+	size_t mid_allocs;
+	size_t mid_frees;
+	size_t mid_live_bytes;    /* in live mid-size allocations */
+
+	size_t bulk_allocs;
+	size_t bulk_frees;
+	size_t bulk_live_bytes;   /* in live bulk allocations */
+	size_t bulk_cached_bytes; /* in freed mappings kept for reuse */
+
+	/* System calls made for pool and bulk memory. */
+	size_t mmap_calls;
+	size_t munmap_calls;
+	size_t mremap_calls;
+	size_t madvise_calls;
+};
+
+/* Fills in stats.  Returns 0. */
+int mm_stats(struct mm_stats *stats);
+
+/*
+ * Returns all free pool memory and cached bulk mappings to the OS now,
+ * instead of waiting for them to decay.  Returns the number of bytes
+ * released.
+ */
+size_t mm_trim(void);
+
+/*
+ * Returns the NUMA node whose arenas own the pool block at ptr, or -1
+ * if ptr is a bulk allocation.  Nodes are numbered as in
+ * /sys/devices/system/node, or by their position in MM_NUMA_NODES when
+ * that overrides the topology.
+ */
+int mm_numa_node(void *ptr);
+
+/*
+ * Writes the live samples of the heap profiler to path in the legacy
+ * pprof heap format.  Sampling is enabled by setting MM_PROF_RATE to the
+ * mean number of bytes allocated between samples.  Returns 0, or -1 if
+ * profiling is off or the file could not be written.
+ */
+int mm_prof_dump(const char *path);
+
+/*
+ * Allocates n blocks of size bytes each and stores them in out.  Returns
+ * the number of blocks allocated, which is less than n only when memory
+ * runs out; the blocks that were allocated must still be freed.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/*
+ * Frees the n blocks in ptrs, as free() would one at a time.  NULL
+ * entries are skipped.
+ */
+void mm_free_batch(void **ptrs, size_t n);
+
+/*
+ * Object caches, for types allocated in large numbers at one size.  A
+ * cache packs its objects into slabs of their exact size, rounded up to
+ * the alignment, and serves them from per-thread magazines.
+ *
+ * mm_cache_create() returns a cache of obj_size-byte objects aligned to
+ * align, a power of two up to the page size (0 for pointer alignment),
+ * or NULL with errno set to EINVAL if the parameters are not supported
+ * or to ENOMEM.  Objects from mm_cache_alloc() must be returned with
+ * mm_cache_free() on the same cache, never with free().
+ * mm_cache_destroy() releases the cache and every object it handed out;
+ * no other thread may be using the cache at that point.
+ */
+struct mm_cache;
+
+struct mm_cache_stats {
+	size_t obj_size;      /* bytes per object, after alignment */
+	size_t slab_bytes;    /* bytes per slab */
+	size_t slab_objs;     /* objects per slab */
+	size_t slabs;         /* slabs held by the cache */
+	size_t live_objs;     /* allocated and not yet freed */
+	size_t cached_objs;   /* free in the threads' magazines */
+	size_t allocs;
+	size_t frees;
+};
+
+struct mm_cache *mm_cache_create(size_t obj_size, size_t align);
+void mm_cache_destroy(struct mm_cache *cache);
+void *mm_cache_alloc(struct mm_cache *cache);
+void mm_cache_free(struct mm_cache *cache, void *obj);
+
+/* Fills in stats for cache.  Returns 0. */
+int mm_cache_stats(struct mm_cache *cache, struct mm_cache_stats *stats);
+
+/*
+ * Regions, for objects that all die at the same time.  mm_region_alloc()
+ * returns size bytes aligned to 16 from the region, or NULL with errno
+ * set to ENOMEM; there is no way to free them one by one.
+ * mm_region_reset() frees everything allocated from the region in
+ * constant time and keeps its memory for reuse, except for allocations
+ * larger than 16 KB, which are unmapped.  mm_region_destroy() frees
+ * everything and returns the memory to the allocator.  A region must
+ * not be used by two threads at the same time.
+ */
+struct mm_region;
+
+struct mm_region *mm_region_create(void);
+void *mm_region_alloc(struct mm_region *region, size_t size);
+void mm_region_reset(struct mm_region *region);
+void mm_region_destroy(struct mm_region *region);
+
+#endif
@@ -0,0 +1,178 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/*
+ * NUMA topology.  The nodes and the CPUs on each are read once from
+ * /sys/devices/system/node; MM_NUMA_NODES overrides them with a list of
+ * CPU lists separated by semicolons, one per node, so that
+ * MM_NUMA_NODES="0-3;4-7" describes two nodes of four CPUs whether the
+ * machine has them or not.  Nodes are referred to by their position in
+ * that list (an index); numa_node_id() maps an index to the node number
+ * the kernel uses.
+ *
+ * Memory is bound to a node with mbind(MPOL_PREFERRED) before it is
+ * first touched, so that pages fault in on that node even when another
+ * node's thread writes them first, and fall back to other nodes rather
+ * than failing when it is full.  Binding is best-effort: errors, such
+ * as a node in MM_NUMA_NODES the machine does not have, are ignored.
+ * With a single node nothing is bound and the kernel's local policy
+ * applies.  The system call is made directly so that the library does
+ * not depend on libnuma.
+ */
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+
+static pthread_once_t gNumaOnce = PTHREAD_ONCE_INIT;
+static int gNumaCount = 1;
+static int gNumaId[NUMA_MAX_NODES];
+static unsigned char gCpuNode[NUMA_MAX_CPUS];
+
+/*
+ * Parses a kernel CPU or node list ("0-3,8-11") starting at s and calls
+ * fn for each number in it.  Stops at the end of the string, a newline
+ * or a semicolon, and returns a pointer to that character.
+ */
+static const char *parse_list(const char *s, void (*fn)(long value, int arg), int arg)
+{
+	while (*s != '\0' && *s != '\n' && *s != ';') {
+		char *end;
+		long first = strtol(s, &end, 10);
+		if (end == s)
+			break;
+		long last = first;
+		s = end;
+		if (*s == '-') {
+			last = strtol(s + 1, &end, 10);
+			if (end == s + 1)
+				break;
+			s = end;
+		}
+		for (long v = first; v <= last && v < NUMA_MAX_CPUS; v++)
+			fn(v, arg);
+		if (*s == ',')
+			s++;
+	}
+	return s;
+}
+
+static void set_cpu_node(long cpu, int node)
+{
+	if (cpu >= 0)
+		gCpuNode[cpu] = node;
+}
+
+static void add_node(long id, int unused)
+{
+	if (id >= 0 && id < NUMA_MAX_NODES && gNumaCount < NUMA_MAX_NODES)
+		gNumaId[gNumaCount++] = id;
+}
+
+/* Reads a small sysfs file into buf without allocating.  Returns 0, or
+ * -1 if it could not be read. */
+static int read_file(const char *path, char *buf, size_t size)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	ssize_t n = read(fd, buf, size - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	return 0;
+}
+
+static void numa_init(void)
+{
+	char buf[4096];
+	const char *env = getenv("MM_NUMA_NODES");
+
+	if (env != NULL && *env != '\0') {
+		int count = 0;
+		for (const char *s = env; count < NUMA_MAX_NODES; s++) {
+			gNumaId[count] = count;
+			s = parse_list(s, set_cpu_node, count);
+			count++;
+			if (*s != ';')
+				break;
+		}
+		gNumaCount = count;
+		return;
+	}
+
+	if (read_file("/sys/devices/system/node/online", buf, sizeof(buf)) != 0)
+		return;
+	gNumaCount = 0;
+	parse_list(buf, add_node, 0);
+	if (gNumaCount <= 1) {
+		gNumaCount = 1;
+		gNumaId[0] = 0;
+		return;
+	}
+	for (int i = 0; i < gNumaCount; i++) {
+		char path[64];
+		memcpy(path, "/sys/devices/system/node/node", 29);
+		// itoa without stdio, which may allocate
+		char digits[8];
+		int n = 0, id = gNumaId[i];
+		do {
+			digits[n++] = '0' + id % 10;
+			id /= 10;
+		} while (id > 0);
+		for (int j = 0; j < n; j++)
+			path[29 + j] = digits[n - 1 - j];
+		memcpy(path + 29 + n, "/cpulist", 9);
+		if (read_file(path, buf, sizeof(buf)) == 0)
+			parse_list(buf, set_cpu_node, i);
+	}
+}
+
+/* Returns the number of nodes, at least 1. */
+int numa_nodes(void)
+{
+	pthread_once(&gNumaOnce, numa_init);
+	return gNumaCount;
+}
+
+/* Returns the index of the node of cpu, or 0 if it is not known. */
+int numa_cpu_node(int cpu)
+{
+	pthread_once(&gNumaOnce, numa_init);
+	if (cpu < 0 || cpu >= NUMA_MAX_CPUS)
+		return 0;
+	return gCpuNode[cpu];
+}
+
+/* Returns the kernel's number for the node at index. */
+int numa_node_id(int index)
+{
+	return gNumaId[index];
+}
+
+/* Binds the len bytes at addr, which must be page-aligned, to the node
+ * at index. */
+void numa_bind(void *addr, size_t len, int index)
+{
+	if (numa_nodes() <= 1)
+		return;
+	unsigned long mask = 1UL << gNumaId[index];
+	// the kernel reads one bit less than maxnode
+	syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0);
+}
+
+/* Binds the len bytes at addr to the node of the calling thread. */
+void numa_bind_local(void *addr, size_t len)
+{
+	if (numa_nodes() <= 1)
+		return;
+	numa_bind(addr, len, numa_cpu_node(sched_getcpu()));
+}
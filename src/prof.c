@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+
+#include "mm.h"
+
+/*
+ * Sampling heap profiler.  With MM_PROF_RATE=n set, about one allocation
+ * per n bytes allocated is sampled: the gaps between samples are drawn
+ * from an exponential distribution with mean n, so that every byte has
+ * the same chance of being the one that triggers a sample and the
+ * profile can be unsampled exactly.  A sample records the allocation's
+ * size and call stack in a fixed table mapped directly with mmap(), so
+ * that recording never calls back into malloc().  The sample is dropped
+ * from the table when its block is freed.
+ *
+ * mm_prof_dump() writes the live samples in the legacy pprof heap
+ * format ("heap_v2"), which `pprof --text program file` reads.
+ */
+#define PROF_DEPTH 32
+#define PROF_SHIFT 15
+#define PROF_SLOTS (1 << PROF_SHIFT)
+
+typedef struct ProfSample {
+	void *ptr;
+	size_t size;
+	int depth;
+	void *stack[PROF_DEPTH];
+} ProfSample;
+
+int gProfOn;
+static long gProfRate;
+static pthread_once_t gProfOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t gProfLock = PTHREAD_MUTEX_INITIALIZER;
+static ProfSample *gProfTable;
+static size_t gProfLive;
+static size_t gProfAllocs;
+static size_t gProfAllocBytes;
+static __thread uint64_t gProfSeed __attribute__((tls_model("initial-exec")));
+
+static void prof_init(void)
+{
+	const char *env = getenv("MM_PROF_RATE");
+	if (env == NULL || atol(env) <= 0)
+		return;
+	gProfTable = mmap(NULL, sizeof(ProfSample) * PROF_SLOTS, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (gProfTable == MAP_FAILED)
+		return;
+	gProfRate = atol(env);
+	// backtrace() loads its unwinder on first use, which allocates
+	void *frame;
+	backtrace(&frame, 1);
+	__atomic_store_n(&gProfOn, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the number of bytes to allocate before the next sample, or
+ * LONG_MAX if profiling is off.
+ */
+long prof_interval(void)
+{
+	pthread_once(&gProfOnce, prof_init);
+	if (!gProfOn)
+		return LONG_MAX;
+	if (gProfSeed == 0)
+		gProfSeed = (uintptr_t)&gProfSeed ^ (uint64_t)time(NULL) << 20 ^ 0x9e3779b97f4a7c15ULL;
+	// xorshift64*, then 53 bits in (0, 1]
+	gProfSeed ^= gProfSeed >> 12;
+	gProfSeed ^= gProfSeed << 25;
+	gProfSeed ^= gProfSeed >> 27;
+	double u = ((gProfSeed * 0x2545f4914f6cdd1dULL >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double gap = -log(u) * gProfRate;
+	return gap >= (double)LONG_MAX ? LONG_MAX : (long)gap + 1;
+}
+
+static size_t prof_slot(void *ptr)
+{
+	return ((uintptr_t)ptr >> 4) * 0x9e3779b97f4a7c15ULL >> (64 - PROF_SHIFT);
+}
+
+/*
+ * Records a sample for the size-byte block at ptr.  Returns 0, or -1 if
+ * the table is full and the sample was dropped.
+ */
+int prof_record(void *ptr, size_t size)
+{
+	ProfSample sample;
+	sample.ptr = ptr;
+	sample.size = size;
+	sample.depth = backtrace(sample.stack, PROF_DEPTH);
+
+	pthread_mutex_lock(&gProfLock);
+	gProfAllocs++;
+	gProfAllocBytes += size;
+	if (gProfLive >= PROF_SLOTS - PROF_SLOTS / 8) {
+		pthread_mutex_unlock(&gProfLock);
+		return -1;
+	}
+	size_t i = prof_slot(ptr);
+	while (gProfTable[i].ptr != NULL)
+		i = (i + 1) & (PROF_SLOTS - 1);
+	gProfTable[i] = sample;
+	gProfLive++;
+	pthread_mutex_unlock(&gProfLock);
+	return 0;
+}
+
+/* Drops the sample for the block at ptr, if there is one. */
+void prof_release(void *ptr)
+{
+	pthread_mutex_lock(&gProfLock);
+	size_t i = prof_slot(ptr);
+	while (gProfTable[i].ptr != NULL && gProfTable[i].ptr != ptr)
+		i = (i + 1) & (PROF_SLOTS - 1);
+	if (gProfTable[i].ptr == NULL) {
+		pthread_mutex_unlock(&gProfLock);
+		return;
+	}
+	// shift later entries of the probe sequence back into the hole
+	size_t hole = i;
+	for (size_t j = (i + 1) & (PROF_SLOTS - 1); gProfTable[j].ptr != NULL;
+		 j = (j + 1) & (PROF_SLOTS - 1)) {
+		size_t home = prof_slot(gProfTable[j].ptr);
+		if (((j - home) & (PROF_SLOTS - 1)) >= ((j - hole) & (PROF_SLOTS - 1))) {
+			gProfTable[hole] = gProfTable[j];
+			hole = j;
+		}
+	}
+	gProfTable[hole].ptr = NULL;
+	gProfLive--;
+	pthread_mutex_unlock(&gProfLock);
+}
+
+/* Fork handlers, run from the allocator's own. */
+void prof_fork_prepare(void)
+{
+	pthread_mutex_lock(&gProfLock);
+}
+
+void prof_fork_parent(void)
+{
+	pthread_mutex_unlock(&gProfLock);
+}
+
+void prof_fork_child(void)
+{
+	pthread_mutex_init(&gProfLock, NULL);
+}
+
+/* Output goes through a buffer on the stack, so that dumping allocates
+ * nothing. */
+typedef struct ProfOut {
+	int fd;
+	size_t len;
+	int error;
+	char buf[4096];
+} ProfOut;
+
+static void out_flush(ProfOut *out)
+{
+	char *p = out->buf;
+	while (out->len > 0) {
+		ssize_t n = write(out->fd, p, out->len);
+		if (n <= 0) {
+			out->error = 1;
+			out->len = 0;
+			return;
+		}
+		p += n;
+		out->len -= n;
+	}
+}
+
+static void out_printf(ProfOut *out, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void out_printf(ProfOut *out, const char *fmt, ...)
+{
+	va_list ap;
+	if (out->len > sizeof(out->buf) - 256)
+		out_flush(out);
+	va_start(ap, fmt);
+	int n = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt, ap);
+	va_end(ap);
+	if (n > 0)
+		out->len += (size_t)n < sizeof(out->buf) - out->len ? (size_t)n : 0;
+}
+
+int mm_prof_dump(const char *path)
+{
+	ProfOut out;
+	size_t objects = 0, bytes = 0;
+
+	if (!gProfOn)
+		return -1;
+	out.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out.fd < 0)
+		return -1;
+	out.len = 0;
+	out.error = 0;
+
+	pthread_mutex_lock(&gProfLock);
+	for (size_t i = 0; i < PROF_SLOTS; i++) {
+		if (gProfTable[i].ptr != NULL) {
+			objects++;
+			bytes += gProfTable[i].size;
+		}
+	}
+	out_printf(&out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%ld\n",
+			   objects, bytes, gProfAllocs, gProfAllocBytes, gProfRate);
+	for (size_t i = 0; i < PROF_SLOTS; i++) {
+		ProfSample *s = &gProfTable[i];
+		if (s->ptr == NULL)
+			continue;
+		out_printf(&out, "1: %zu [1: %zu] @", s->size, s->size);
+		for (int d = 0; d < s->depth; d++)
+			out_printf(&out, " %p", s->stack[d]);
+		out_printf(&out, "\n");
+	}
+	pthread_mutex_unlock(&gProfLock);
+
+	// pprof symbolizes the addresses with the mappings of the process
+	out_printf(&out, "\nMAPPED_LIBRARIES:\n");
+	out_flush(&out);
+	int maps = open("/proc/self/maps", O_RDONLY);
+	if (maps >= 0) {
+		ssize_t n;
+		while ((n = read(maps, out.buf, sizeof(out.buf))) > 0) {
+			out.len = n;
+			out_flush(&out);
+		}
+		close(maps);
+	}
+	close(out.fd);
+	return out.error ? -1 : 0;
+}
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/mm.h"
+
+#define NBATCH 5000
+
+static void *ptrs[NBATCH];
+
+/* This test allocates batches of blocks of several sizes, pool and bulk,
+ * checks that every block is distinct and writable, and frees them with
+ * mm_free_batch(), then repeats so that the second round is served from
+ * the blocks the first one returned. */
+static int fill(size_t size, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        memset(ptrs[i], (int)i, size);
+    }
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char *p = ptrs[i];
+        if (p[0] != (unsigned char)i || p[size - 1] != (unsigned char)i) {
+            fprintf(stderr, "block %zu of size %zu overlaps another\n", i, size);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 8, 24, 100, 1000, 4000, 20000 };
+
+    for (int round = 0; round < 2; round++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t n = sizes[s] > 4096 ? NBATCH / 50 : NBATCH;
+            if (mm_malloc_batch(sizes[s], n, ptrs) != n) {
+                fprintf(stderr, "batch of %zu failed\n", sizes[s]);
+                return 1;
+            }
+            if (fill(sizes[s], n)) {
+                return 1;
+            }
+            mm_free_batch(ptrs, n);
+        }
+    }
+
+    /* Blocks from malloc() can be freed in a batch too. */
+    for (int i = 0; i < 100; i++) {
+        ptrs[i] = i % 10 ? malloc(i * 50 + 1) : NULL;
+    }
+    mm_free_batch(ptrs, 100);
+    return 0;
+}
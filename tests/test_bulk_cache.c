@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/mm.h"
+
+#define ALLOC_SIZE (2 << 20)
+#define ROUNDS 100
+
+/* This test checks that a freed bulk allocation is reused by the next
+ * allocation of the same size instead of going back to the OS, and that
+ * a reused region is fully writable.  Mixed sizes are interleaved so
+ * the cache has to keep more than one bucket.  The sizes are past the
+ * mid-size runs, so every block is a mapping of its own. */
+int main(int argc, char *argv[])
+{
+    struct mm_stats before, after;
+
+    char *p1 = malloc(ALLOC_SIZE);
+    if (p1 == NULL) {
+        return 1;
+    }
+    memset(p1, 0xa5, ALLOC_SIZE);
+    uintptr_t freed = (uintptr_t)p1;
+    free(p1);
+    mm_stats(&before);
+    if (before.bulk_cached_bytes < ALLOC_SIZE) {
+        fprintf(stderr, "freed mapping not cached\n");
+        return 1;
+    }
+
+    char *p2 = malloc(ALLOC_SIZE);
+    mm_stats(&after);
+    if ((uintptr_t)p2 != freed || after.mmap_calls != before.mmap_calls) {
+        fprintf(stderr, "freed mapping not reused\n");
+        return 1;
+    }
+    free(p2);
+
+    mm_stats(&before);
+    for (int i = 0; i < ROUNDS; i++) {
+        size_t size = ALLOC_SIZE + ALLOC_SIZE / 8 * (i % 4);
+        char *a = malloc(size);
+        char *b = malloc(2 * size);
+        if (a == NULL || b == NULL) {
+            return 1;
+        }
+        memset(a, i, size);
+        memset(b, i, 2 * size);
+        free(a);
+        free(b);
+    }
+    // the eight sizes fit in the cache together, so only the first
+    // round of each maps anything
+    mm_stats(&after);
+    if (after.mmap_calls - before.mmap_calls > 8) {
+        fprintf(stderr, "%zu mappings for %d rounds\n",
+                after.mmap_calls - before.mmap_calls, ROUNDS);
+        return 1;
+    }
+    return 0;
+}
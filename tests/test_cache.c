@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "../src/mm.h"
+
+#define NOBJS 5000
+#define NTHREADS 4
+#define ROUNDS 20
+
+/* This test checks that object caches pack their objects at the exact
+ * size and alignment asked for, that objects are not handed out twice,
+ * and that the counts add up when threads allocate and free, also on
+ * each other's behalf. */
+static struct mm_cache *shared;
+static void *handoff[NTHREADS][NOBJS / NTHREADS];
+
+static void *worker(void *arg)
+{
+    long id = (long)arg;
+    void *objs[NOBJS / NTHREADS];
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NOBJS / NTHREADS; i++) {
+            objs[i] = mm_cache_alloc(shared);
+            if (objs[i] == NULL) {
+                return (void *)1;
+            }
+            memset(objs[i], (int)id, 40);
+        }
+        for (int i = 0; i < NOBJS / NTHREADS; i++) {
+            if (((unsigned char *)objs[i])[39] != id) {
+                return (void *)1;
+            }
+            mm_cache_free(shared, objs[i]);
+        }
+    }
+    // leave some for the main thread to free
+    for (int i = 0; i < NOBJS / NTHREADS; i++) {
+        handoff[id][i] = mm_cache_alloc(shared);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static void *objs[NOBJS];
+    struct mm_cache_stats stats;
+    pthread_t threads[NTHREADS];
+
+    struct mm_cache *cache = mm_cache_create(40, 0);
+    if (cache == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < NOBJS; i++) {
+        objs[i] = mm_cache_alloc(cache);
+        if (objs[i] == NULL || (uintptr_t)objs[i] % sizeof(void *) != 0) {
+            return 1;
+        }
+        memset(objs[i], 0, 40);
+        *(int *)objs[i] = i;
+    }
+    for (int i = 0; i < NOBJS; i++) {
+        if (*(int *)objs[i] != i) {
+            fprintf(stderr, "object %d overwritten\n", i);
+            return 1;
+        }
+    }
+    mm_cache_stats(cache, &stats);
+    if (stats.obj_size != 40 || stats.slab_objs != stats.slab_bytes / 40 ||
+        stats.live_objs != NOBJS ||
+        stats.slabs > (NOBJS + stats.slab_objs - 1) / stats.slab_objs + 1) {
+        fprintf(stderr, "size %zu, %zu per slab of %zu, %zu live in %zu slabs\n",
+                stats.obj_size, stats.slab_objs, stats.slab_bytes, stats.live_objs,
+                stats.slabs);
+        return 1;
+    }
+    for (int i = 0; i < NOBJS; i++) {
+        mm_cache_free(cache, objs[i]);
+    }
+    /* The objects left in the magazine may keep two slabs, and one
+     * empty slab is kept. */
+    mm_cache_stats(cache, &stats);
+    if (stats.live_objs != 0 || stats.slabs > 3) {
+        fprintf(stderr, "%zu live in %zu slabs after freeing\n", stats.live_objs, stats.slabs);
+        return 1;
+    }
+    mm_cache_destroy(cache);
+
+    /* Alignment rounds the size up. */
+    cache = mm_cache_create(100, 64);
+    if (cache == NULL) {
+        return 1;
+    }
+    for (int i = 0; i < 100; i++) {
+        objs[i] = mm_cache_alloc(cache);
+        if (objs[i] == NULL || (uintptr_t)objs[i] % 64 != 0) {
+            return 1;
+        }
+    }
+    mm_cache_stats(cache, &stats);
+    if (stats.obj_size != 128) {
+        return 1;
+    }
+    mm_cache_destroy(cache);
+
+    errno = 0;
+    if (mm_cache_create(16, 24) != NULL || errno != EINVAL ||
+        mm_cache_create(0, 0) != NULL || mm_cache_create((size_t)1 << 40, 0) != NULL) {
+        return 1;
+    }
+
+    shared = mm_cache_create(40, 0);
+    for (long i = 0; i < NTHREADS; i++) {
+        if (pthread_create(&threads[i], NULL, worker, (void *)i) != 0) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        void *result;
+        pthread_join(threads[i], &result);
+        if (result != NULL) {
+            return 1;
+        }
+    }
+    for (int t = 0; t < NTHREADS; t++) {
+        for (int i = 0; i < NOBJS / NTHREADS; i++) {
+            mm_cache_free(shared, handoff[t][i]);
+        }
+    }
+    mm_cache_stats(shared, &stats);
+    size_t total = (size_t)NTHREADS * (ROUNDS + 1) * (NOBJS / NTHREADS);
+    if (stats.allocs != total || stats.frees != total || stats.live_objs != 0) {
+        fprintf(stderr, "%zu allocs, %zu frees, expected %zu\n", stats.allocs, stats.frees, total);
+        return 1;
+    }
+    mm_cache_destroy(shared);
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LARGE_SIZE (64 * 1024 * 1024)
+#define SMALL_SIZE 200
+#define ROUNDS 1000
+
+/* This test checks that calloc() returns cleared memory whether or not
+ * the block was used before, that it refuses element counts whose
+ * product overflows, and that a large calloc() does not touch the pages
+ * it hands out. */
+static long resident_pages(void)
+{
+    char buf[64] = { 0 };
+    long size, resident;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if (fd < 0 || read(fd, buf, sizeof(buf) - 1) <= 0) {
+        return -1;
+    }
+    close(fd);
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) {
+        return -1;
+    }
+    return resident;
+}
+
+static int is_zero(const unsigned char *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    /* volatile keeps the compiler from rejecting the call outright */
+    volatile size_t nmemb = SIZE_MAX / 2;
+
+    errno = 0;
+    if (calloc(nmemb, 4) != NULL || errno != ENOMEM) {
+        fprintf(stderr, "overflowing calloc() not refused\n");
+        return 1;
+    }
+
+    /* Dirty blocks of every kind, then check calloc() clears them. */
+    for (int i = 0; i < ROUNDS; i++) {
+        size_t size = i % 2 ? SMALL_SIZE : 32 * 1024;
+        unsigned char *p = malloc(size);
+        memset(p, 0xff, size);
+        free(p);
+        p = calloc(1, size);
+        if (p == NULL || !is_zero(p, size)) {
+            fprintf(stderr, "calloc(%zu) returned dirty memory\n", size);
+            return 1;
+        }
+        memset(p, 0xff, size);
+        free(p);
+    }
+
+    long before = resident_pages();
+    unsigned char *large = calloc(LARGE_SIZE / 8, 8);
+    long after = resident_pages();
+    if (large == NULL || !is_zero(large + LARGE_SIZE - 4096, 4096)) {
+        return 1;
+    }
+    if ((after - before) * sysconf(_SC_PAGESIZE) > LARGE_SIZE / 4) {
+        fprintf(stderr, "calloc() touched %ld pages\n", after - before);
+        return 1;
+    }
+    free(large);
+    return 0;
+}
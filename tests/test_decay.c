@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/mm.h"
+
+#define NBLOCKS (64 * 1024)
+#define BLOCK_SIZE 248
+#define DECAY "200"
+#define IDLE_US 600000
+
+/* This test checks that freed pool memory stays resident for the decay
+ * interval and is handed back once it has been idle for longer: first
+ * with the decay passes run from allocation calls, then by the
+ * background thread while the program sleeps.  mm_trim() must release
+ * it at once. */
+static long resident_pages(void)
+{
+    char buf[64] = { 0 };
+    long size, resident;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if (fd < 0 || read(fd, buf, sizeof(buf) - 1) <= 0) {
+        return -1;
+    }
+    close(fd);
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) {
+        return -1;
+    }
+    return resident;
+}
+
+static void *blocks[NBLOCKS];
+
+static long fill(void)
+{
+    for (int i = 0; i < NBLOCKS; i++) {
+        if ((blocks[i] = malloc(BLOCK_SIZE)) == NULL) {
+            exit(1);
+        }
+        memset(blocks[i], 0xa5, BLOCK_SIZE);
+    }
+    return resident_pages();
+}
+
+static void empty(void)
+{
+    for (int i = 0; i < NBLOCKS; i++) {
+        free(blocks[i]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct mm_stats full, freed;
+    long before, peak, after;
+    int status;
+
+    /* The decay settings are read on the first allocation: run once
+     * without the background thread and once with it. */
+    if (getenv("MM_DECAY_MS") == NULL) {
+        setenv("MM_DECAY_MS", DECAY, 1);
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv("/proc/self/exe", argv);
+            _exit(1);
+        }
+        if (pid < 0 || waitpid(pid, &status, 0) != pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            return 1;
+        }
+        setenv("MM_DECAY_THREAD", "1", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+    int threaded = getenv("MM_DECAY_THREAD") != NULL;
+
+    before = resident_pages();
+    peak = fill();
+    mm_stats(&full);
+    empty();
+    mm_stats(&freed);
+    if (freed.reserved_bytes != full.reserved_bytes) {
+        fprintf(stderr, "pool memory released before the decay interval\n");
+        return 2;
+    }
+
+    usleep(IDLE_US);
+    if (!threaded) {
+        // any allocation that refills the thread cache runs the pass
+        free(malloc(64));
+    }
+    after = resident_pages();
+    if (after - before > (peak - before) / 4) {
+        fprintf(stderr, "after decay: before %ld, peak %ld, after %ld resident pages\n",
+                before, peak, after);
+        return 3;
+    }
+
+    before = resident_pages();
+    peak = fill();
+    empty();
+    if (mm_trim() == 0) {
+        fprintf(stderr, "mm_trim() released nothing\n");
+        return 4;
+    }
+    after = resident_pages();
+    if (after - before > (peak - before) / 4) {
+        fprintf(stderr, "after mm_trim(): before %ld, peak %ld, after %ld resident pages\n",
+                before, peak, after);
+        return 5;
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../src/mm.h"
+
+void *aligned_alloc(size_t align, size_t size);
+void free_sized(void *ptr, size_t size);
+
+#define BULK_SIZE 100000
+
+/* This test is linked against the hardened build.  Ordinary use must
+ * work as before, and each kind of misuse below, run in a child of its
+ * own, must abort the child. */
+
+/* Hides a pointer from the compiler, which would reject the misuse. */
+static void *volatile hidden;
+
+static char *launder(void *ptr)
+{
+    hidden = ptr;
+    return hidden;
+}
+
+static void double_free(void)
+{
+    char *p = malloc(64);
+    char *again = launder(p);
+    free(p);
+    free(again);
+}
+
+static void double_free_bulk(void)
+{
+    char *p = malloc(BULK_SIZE);
+    char *again = launder(p);
+    free(p);
+    free(again);
+}
+
+static void double_free_sized(void)
+{
+    char *p = malloc(64);
+    free_sized(p, 64);
+    free(p);
+}
+
+static void header_overwrite(void)
+{
+    char *p = malloc(64);
+    // an underflow from the block before clobbers the header
+    memset(launder(p) - sizeof(size_t), 0x41, sizeof(size_t));
+    free(p);
+}
+
+static void link_overwrite(void)
+{
+    char *p = malloc(64);
+    char *q = malloc(64);
+    uintptr_t bad = (uintptr_t)p + 8;
+    char *stale = launder(q);
+    free(p);
+    free(q);
+    // a write after free replaces the link to p
+    memcpy(stale, &bad, sizeof(bad));
+    hidden = malloc(64);
+    hidden = malloc(64);
+}
+
+static void interior_pointer(void)
+{
+    char *p = malloc(256);
+    memset(p, 0, 256);
+    free(launder(p + 64));
+}
+
+static void wrong_size(void)
+{
+    char *p = malloc(64);
+    free_sized(p, 1000);
+}
+
+static const struct {
+    const char *name;
+    void (*misuse)(void);
+} cases[] = {
+    { "double free", double_free },
+    { "bulk double free", double_free_bulk },
+    { "double free after free_sized", double_free_sized },
+    { "header overwrite", header_overwrite },
+    { "free-list link overwrite", link_overwrite },
+    { "interior pointer", interior_pointer },
+    { "free_sized with the wrong size", wrong_size },
+};
+
+int main(int argc, char *argv[])
+{
+    void *ptrs[64];
+
+    for (size_t size = 1; size <= 20000; size += size < 512 ? 7 : 331) {
+        char *p = malloc(size);
+        memset(p, 1, size);
+        p = realloc(p, size * 2);
+        free(p);
+    }
+    for (size_t align = 16; align <= 8192; align *= 2) {
+        char *p = aligned_alloc(align, 300);
+        memset(p, 2, 300);
+        free(p);
+    }
+    size_t n = mm_malloc_batch(48, 64, ptrs);
+    mm_free_batch(ptrs, n);
+    free(calloc(10, BULK_SIZE));
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(2);
+            cases[i].misuse();
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+            fprintf(stderr, "%s not caught\n", cases[i].name);
+            return 1;
+        }
+    }
+    return 0;
+}
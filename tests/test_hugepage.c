@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/mm.h"
+
+#define HUGE_SIZE (2UL << 20)
+#define ALLOC_SIZE (8UL << 20)
+
+/* This test turns the huge page policy on and checks that a large
+ * allocation is placed on a 2 MB boundary and accounted for, whichever
+ * way the system let it be backed, and that growing it past the next
+ * huge page keeps its contents, its alignment and the accounting.  Whether huge pages are actually
+ * resident depends on the machine, so that is only reported. */
+int main(int argc, char *argv[])
+{
+    struct mm_huge_stats stats;
+
+    /* The policy is read on the first allocation, which may well happen
+     * before main(), so set it and start over. */
+    if (getenv("MM_HUGEPAGE_THRESHOLD") == NULL) {
+        setenv("MM_HUGEPAGE_THRESHOLD", "4194304", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    unsigned char *buf = malloc(ALLOC_SIZE);
+    if (buf == NULL) {
+        return 1;
+    }
+    /* The bulk header word sits at the start of the mapping. */
+    if (((uintptr_t)buf - sizeof(size_t)) % HUGE_SIZE != 0) {
+        fprintf(stderr, "huge mapping not aligned: %p\n", buf);
+        return 1;
+    }
+    for (size_t i = 0; i < ALLOC_SIZE; i++) {
+        buf[i] = (unsigned char)i;
+    }
+
+    mm_huge_stats(&stats);
+    if (stats.requested_bytes < ALLOC_SIZE ||
+        stats.hugetlb_bytes + stats.advised_bytes + stats.fallback_bytes
+        != stats.requested_bytes) {
+        fprintf(stderr, "huge page counters not updated\n");
+        return 1;
+    }
+
+    struct mm_huge_stats grown;
+    buf = realloc(buf, ALLOC_SIZE + HUGE_SIZE);
+    if (buf == NULL) {
+        return 1;
+    }
+    mm_huge_stats(&grown);
+    if (((uintptr_t)buf - sizeof(size_t)) % HUGE_SIZE != 0 ||
+        grown.requested_bytes < stats.requested_bytes + ALLOC_SIZE + HUGE_SIZE) {
+        fprintf(stderr, "grown mapping not aligned or not accounted for\n");
+        return 1;
+    }
+    for (size_t i = 0; i < ALLOC_SIZE; i++) {
+        if (buf[i] != (unsigned char)i) {
+            fprintf(stderr, "byte %zu lost in realloc\n", i);
+            return 1;
+        }
+    }
+    memset(buf + ALLOC_SIZE, 0, HUGE_SIZE);
+    free(buf);
+
+    /* Below the threshold nothing changes. */
+    struct mm_huge_stats after;
+    mm_huge_stats(&stats);
+    buf = malloc(1 << 20);
+    free(buf);
+    mm_huge_stats(&after);
+    if (after.requested_bytes != stats.requested_bytes) {
+        fprintf(stderr, "small mapping counted as huge\n");
+        return 1;
+    }
+    return 0;
+}
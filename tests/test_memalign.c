@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <malloc.h>
+
+void *aligned_alloc(size_t align, size_t size);
+
+#define NALLOCS 64
+
+/* This test requests every power-of-two alignment from 8 bytes to 1 MB
+ * through each of the aligned allocation calls, checks the alignment and
+ * the usable size, writes the whole block and frees it.  It also
+ * reallocates an aligned block and checks posix_memalign()'s argument
+ * validation. */
+static int check(void *ptr, size_t align, size_t size)
+{
+    if (ptr == NULL) {
+        fprintf(stderr, "allocation of %zu at %zu failed\n", size, align);
+        return 1;
+    }
+    if ((uintptr_t)ptr % align != 0) {
+        fprintf(stderr, "%p not aligned to %zu\n", ptr, align);
+        return 1;
+    }
+    if (malloc_usable_size(ptr) < size) {
+        fprintf(stderr, "usable size %zu < %zu\n", malloc_usable_size(ptr), size);
+        return 1;
+    }
+    memset(ptr, 0x5a, malloc_usable_size(ptr));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    void *ptrs[NALLOCS];
+
+    for (size_t align = 8; align <= (1 << 20); align *= 2) {
+        for (int i = 0; i < NALLOCS; i++) {
+            size_t size = 1 + (size_t)i * 97;
+            switch (i % 3) {
+            case 0:
+                if (posix_memalign(&ptrs[i], align, size) != 0) {
+                    ptrs[i] = NULL;
+                }
+                break;
+            case 1:
+                ptrs[i] = aligned_alloc(align, size);
+                break;
+            default:
+                ptrs[i] = memalign(align, size);
+                break;
+            }
+            if (check(ptrs[i], align, size)) {
+                return 1;
+            }
+        }
+        for (int i = 0; i < NALLOCS; i++) {
+            free(ptrs[i]);
+        }
+    }
+
+    char *p = aligned_alloc(64, 100);
+    for (int i = 0; i < 100; i++) {
+        p[i] = i;
+    }
+    p = realloc(p, 10000);
+    for (int i = 0; i < 100; i++) {
+        if (p[i] != i) {
+            fprintf(stderr, "realloc of aligned block lost data\n");
+            return 1;
+        }
+    }
+    free(p);
+
+    void *q;
+    if (posix_memalign(&q, 24, 16) != EINVAL || posix_memalign(&q, 4, 16) != EINVAL) {
+        fprintf(stderr, "bad alignment accepted\n");
+        return 1;
+    }
+    if (malloc_usable_size(NULL) != 0) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../src/mm.h"
+
+#define NBLOCKS 40
+#define BLOCK_SIZE 40000
+#define ROUNDS 1000
+
+/* This test checks that allocations between the size classes and 1 MB
+ * come from page runs in the pools rather than mappings of their own,
+ * that freed runs merge with their free neighbours so that a large
+ * request fits where many small ones were, and that realloc() resizes a
+ * run in place.  The sizes are above the largest class of every
+ * profile. */
+static void *blocks[NBLOCKS];
+
+int main(int argc, char *argv[])
+{
+    struct mm_stats before, after;
+
+    /* Mid-size allocations are served without system calls once the
+     * pools are mapped. */
+    free(malloc(40000));
+    mm_stats(&before);
+    for (int i = 0; i < ROUNDS; i++) {
+        size_t size = 40000 + (size_t)i * 997 % (900 * 1000);
+        char *p = malloc(size);
+        if (p == NULL || mm_numa_node(p) < 0) {
+            fprintf(stderr, "%zu bytes not allocated from the pools\n", size);
+            return 1;
+        }
+        p[0] = p[size - 1] = 1;
+        free(p);
+    }
+    mm_stats(&after);
+    if (after.mid_allocs - before.mid_allocs != ROUNDS ||
+        after.mmap_calls - before.mmap_calls > 1 || after.mid_live_bytes != before.mid_live_bytes) {
+        fprintf(stderr, "%zu mid-size allocations, %zu mappings\n",
+                after.mid_allocs - before.mid_allocs, after.mmap_calls - before.mmap_calls);
+        return 1;
+    }
+
+    /* Free every other block first, so that the runs only become one
+     * again by merging with the neighbours on both sides. */
+    for (int i = 0; i < NBLOCKS; i++) {
+        blocks[i] = malloc(BLOCK_SIZE);
+        if (blocks[i] == NULL) {
+            return 1;
+        }
+        memset(blocks[i], i, BLOCK_SIZE);
+    }
+    mm_stats(&before);
+    for (int i = 0; i < NBLOCKS; i += 2) {
+        free(blocks[i]);
+    }
+    for (int i = 1; i < NBLOCKS; i += 2) {
+        free(blocks[i]);
+    }
+    char *big = malloc(1000 * 1000);
+    mm_stats(&after);
+    if (big == NULL || after.reserved_bytes > before.reserved_bytes) {
+        fprintf(stderr, "freed runs were not merged\n");
+        return 1;
+    }
+
+    /* Growing into the free space after the run, and shrinking. */
+    char *q = malloc(40000);
+    uintptr_t addr = (uintptr_t)q;
+    memset(q, 0x5a, 40000);
+    q = realloc(q, 100000);
+    if ((uintptr_t)q != addr) {
+        fprintf(stderr, "run not grown in place\n");
+        return 1;
+    }
+    q = realloc(q, 36000);
+    if ((uintptr_t)q != addr) {
+        fprintf(stderr, "run not shrunk in place\n");
+        return 1;
+    }
+    for (int i = 0; i < 36000; i++) {
+        if (q[i] != 0x5a) {
+            fprintf(stderr, "byte %d lost in realloc\n", i);
+            return 1;
+        }
+    }
+    free(q);
+    free(big);
+
+    /* Fresh runs are cleared by calloc() and aligned as asked. */
+    for (int i = 0; i < 100; i++) {
+        unsigned char *z = malloc(40000);
+        memset(z, 0xff, 40000);
+        free(z);
+        z = calloc(1, 40000);
+        for (int j = 0; j < 40000; j++) {
+            if (z[j] != 0) {
+                fprintf(stderr, "calloc() returned dirty memory\n");
+                return 1;
+            }
+        }
+        free(z);
+        void *a;
+        if (posix_memalign(&a, 4096, 40000) != 0 || (uintptr_t)a % 4096 != 0) {
+            return 1;
+        }
+        memset(a, 1, 40000);
+        free(a);
+    }
+
+    /* Sizes that wrap around when the header is added fail cleanly
+     * rather than being taken for mid-size ones. */
+    // volatile keeps the compiler from rejecting the calls outright
+    volatile size_t huge = SIZE_MAX - 7;
+    void *out[4];
+    char *r = malloc(40000);
+    errno = 0;
+    if (malloc(huge) != NULL || errno != ENOMEM || malloc(huge + 7) != NULL ||
+        calloc(1, huge) != NULL || realloc(r, huge) != NULL ||
+        mm_malloc_batch(huge, 4, out) != 0) {
+        fprintf(stderr, "huge request did not fail\n");
+        return 1;
+    }
+    // these are not multiples of 8 and wrap around when rounded up
+    for (size_t extra = 6; extra <= 7; extra++) {
+        errno = 0;
+        if (realloc(r, huge + extra) != NULL || errno != ENOMEM) {
+            fprintf(stderr, "realloc() to %zu bytes did not fail\n", huge + extra);
+            return 1;
+        }
+        errno = 0;
+        if (realloc(NULL, huge + extra) != NULL || errno != ENOMEM ||
+            malloc(huge + extra) != NULL || mm_malloc_batch(huge + extra, 4, out) != 0) {
+            fprintf(stderr, "%zu-byte request did not fail\n", huge + extra);
+            return 1;
+        }
+    }
+    r[39999] = 1;
+    free(r);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "../src/mm.h"
+
+/* This test fakes a two-node topology with MM_NUMA_NODES, with the
+ * process pinned to CPU 0, and checks that the blocks of every thread
+ * come from the arenas of CPU 0's node, and that the superblocks are
+ * bound to that node when it exists. */
+static void *worker(void *arg)
+{
+    void *p = malloc(64);
+    int node = mm_numa_node(p);
+    free(p);
+    return (void *)(long)node;
+}
+
+static int check_node(int want)
+{
+    pthread_t threads[4];
+    void *p = malloc(64);
+    void *big = malloc(1 << 20);
+
+    if (mm_numa_node(p) != want) {
+        fprintf(stderr, "block on node %d, expected %d\n", mm_numa_node(p), want);
+        return 1;
+    }
+    if (mm_numa_node(big) != -1) {
+        fprintf(stderr, "bulk block on node %d\n", mm_numa_node(big));
+        return 1;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < 4; i++) {
+        void *node;
+        pthread_join(threads[i], &node);
+        if ((long)node != want) {
+            fprintf(stderr, "thread block on node %ld, expected %d\n", (long)node, want);
+            return 1;
+        }
+    }
+    free(big);
+    free(p);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *nodes = getenv("MM_NUMA_NODES");
+    cpu_set_t cpus;
+
+    /* The topology is read on the first allocation. */
+    if (nodes == NULL) {
+        CPU_ZERO(&cpus);
+        CPU_SET(0, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+            return 1;
+        }
+        setenv("MM_ARENAS", "4", 1);
+        setenv("MM_NUMA_NODES", "1;0", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    if (strcmp(nodes, "1;0") == 0) {
+        // CPU 0 is on the second node, which this machine may not have
+        if (check_node(1) != 0) {
+            return 1;
+        }
+        setenv("MM_NUMA_NODES", "0;1", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    if (check_node(0) != 0) {
+        return 1;
+    }
+    char *p = malloc(64);
+    int mode;
+    unsigned long mask = 0;
+    if (syscall(SYS_get_mempolicy, &mode, &mask, sizeof(mask) * 8 + 1, p, MPOL_F_ADDR) != 0) {
+        // not allowed in some containers
+        return errno == ENOSYS || errno == EPERM ? 0 : 1;
+    }
+    if (mode != MPOL_PREFERRED || mask != 1) {
+        fprintf(stderr, "superblock policy %d mask %lx\n", mode, mask);
+        return 1;
+    }
+    free(p);
+    return 0;
+}
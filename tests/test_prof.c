@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/mm.h"
+
+#define RATE 4096
+#define NBLOCKS 20000
+#define BLOCK_SIZE 1000
+
+static void *blocks[NBLOCKS];
+
+/* This test turns on the sampling profiler, allocates about 20 MB in
+ * 1000-byte blocks and checks that the dumped profile holds roughly the
+ * expected number of samples (one per RATE bytes, so about 4900).  After
+ * the blocks are freed, a second dump must show no live samples. */
+static int count_samples(const char *path, size_t *objects)
+{
+    char line[4096];
+    int samples = 0;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL || fgets(line, sizeof(line), f) == NULL) {
+        return -1;
+    }
+    if (sscanf(line, "heap profile: %zu:", objects) != 1 ||
+        strstr(line, "@ heap_v2/4096") == NULL) {
+        fprintf(stderr, "bad profile header: %s", line);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "1: ", 3) == 0 && strstr(line, " @ 0x") != NULL) {
+            samples++;
+        }
+        if (strncmp(line, "MAPPED_LIBRARIES:", 17) == 0) {
+            break;
+        }
+    }
+    fclose(f);
+    return samples;
+}
+
+int main(int argc, char *argv[])
+{
+    char path[] = "/tmp/test_prof.XXXXXX";
+    size_t objects;
+
+    /* Sampling is configured on the first allocation. */
+    if (getenv("MM_PROF_RATE") == NULL) {
+        setenv("MM_PROF_RATE", "4096", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+
+    for (int i = 0; i < NBLOCKS; i++) {
+        blocks[i] = malloc(BLOCK_SIZE);
+    }
+    if (mm_prof_dump(path) != 0) {
+        fprintf(stderr, "mm_prof_dump() failed\n");
+        return 1;
+    }
+    int samples = count_samples(path, &objects);
+    int expected = NBLOCKS * BLOCK_SIZE / RATE;
+    if (samples < expected / 2 || samples > expected * 2 || objects < (size_t)samples) {
+        fprintf(stderr, "%d samples, expected about %d\n", samples, expected);
+        return 1;
+    }
+
+    for (int i = 0; i < NBLOCKS; i++) {
+        free(blocks[i]);
+    }
+    mm_prof_dump(path);
+    samples = count_samples(path, &objects);
+    unlink(path);
+    if (samples < 0 || objects > 10) {
+        fprintf(stderr, "%d samples left after free\n", samples);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#define MAX_SIZE (1024 * 1024)
+
+/* This test grows a buffer one step at a time from a few bytes to a
+ * megabyte, the way a string builder would, and shrinks it back down.
+ * After every step the contents written so far must still be there.
+ * It also checks that a large buffer grown in small steps is not moved
+ * on every call. */
+static int check(unsigned char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != (unsigned char)(i * 7)) {
+            fprintf(stderr, "byte %zu lost at length %zu\n", i, len);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned char *buf = NULL;
+    size_t len = 0;
+    int moves = 0, steps = 0;
+
+    for (size_t size = 8; size <= MAX_SIZE; size += size / 8 + 1) {
+        unsigned char *next = realloc(buf, size);
+        if (next == NULL) {
+            return 1;
+        }
+        if (next != buf && size > 64 * 1024) {
+            moves++;
+        }
+        if (size > 64 * 1024) {
+            steps++;
+        }
+        buf = next;
+        if (check(buf, len)) {
+            return 1;
+        }
+        for (; len < size; len++) {
+            buf[len] = (unsigned char)(len * 7);
+        }
+    }
+
+    for (size_t size = len; size > 0; size /= 3) {
+        buf = realloc(buf, size);
+        if (buf == NULL || check(buf, size)) {
+            return 1;
+        }
+    }
+    free(buf);
+
+    /* Growing a mapping in place depends on what the kernel placed after
+     * it, so only insist that most steps avoided a move. */
+    if (moves > steps / 2) {
+        fprintf(stderr, "buffer moved on %d of %d steps\n", moves, steps);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../src/mm.h"
+
+#define NALLOCS 4000
+#define ROUNDS 50
+
+/* This test fills a region with small and oversized allocations, checks
+ * that they are aligned and do not overlap, and that resetting the
+ * region reuses its memory instead of taking more. */
+static void *ptrs[NALLOCS];
+static size_t sizes[NALLOCS];
+
+static int fill(struct mm_region *region, int round)
+{
+    for (int i = 0; i < NALLOCS; i++) {
+        sizes[i] = i % 100 == 99 ? 40000 + i : (size_t)(i * 7 + round) % 300;
+        ptrs[i] = mm_region_alloc(region, sizes[i]);
+        if (ptrs[i] == NULL || (uintptr_t)ptrs[i] % 16 != 0) {
+            fprintf(stderr, "bad allocation %p of %zu bytes\n", ptrs[i], sizes[i]);
+            return 1;
+        }
+        memset(ptrs[i], i & 0xff, sizes[i]);
+    }
+    for (int i = 0; i < NALLOCS; i++) {
+        for (size_t j = 0; j < sizes[i]; j += 16) {
+            if (((unsigned char *)ptrs[i])[j] != (i & 0xff)) {
+                fprintf(stderr, "allocation %d overwritten\n", i);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct mm_stats first, last;
+
+    struct mm_region *region = mm_region_create();
+    if (region == NULL) {
+        return 1;
+    }
+    void *start = mm_region_alloc(region, 24);
+    if (fill(region, 0) != 0) {
+        return 1;
+    }
+    mm_region_reset(region);
+    if (mm_region_alloc(region, 24) != start) {
+        fprintf(stderr, "reset did not rewind the region\n");
+        return 1;
+    }
+
+    for (int r = 1; r <= ROUNDS; r++) {
+        mm_region_reset(region);
+        if (fill(region, r) != 0) {
+            return 1;
+        }
+        mm_stats(r == 1 ? &first : &last);
+    }
+    if (last.reserved_bytes > first.reserved_bytes) {
+        fprintf(stderr, "pools grew from %zu to %zu bytes\n",
+                first.reserved_bytes, last.reserved_bytes);
+        return 1;
+    }
+    /* The oversized allocations are the same every round, so their
+     * mappings come back from the bulk cache. */
+    if (last.mmap_calls > first.mmap_calls) {
+        fprintf(stderr, "%zu more mappings made\n", last.mmap_calls - first.mmap_calls);
+        return 1;
+    }
+    mm_region_destroy(region);
+
+    region = mm_region_create();
+    if (region == NULL || fill(region, 0) != 0) {
+        return 1;
+    }
+    mm_region_destroy(region);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define NBLOCKS (64 * 1024)
+#define BLOCK_SIZE 248
+
+/* This test checks that pool memory goes back to the OS once every
+ * block carved from it has been freed.  It fills several superblocks
+ * with small blocks, frees them all, and expects the resident set to
+ * fall most of the way back to where it started.  Decay is turned off,
+ * so that the superblocks are released as soon as they empty. */
+static long resident_pages(void)
+{
+    char buf[64] = { 0 };
+    long size, resident;
+    int fd = open("/proc/self/statm", O_RDONLY);
+
+    if (fd < 0 || read(fd, buf, sizeof(buf) - 1) <= 0) {
+        return -1;
+    }
+    close(fd);
+    if (sscanf(buf, "%ld %ld", &size, &resident) != 2) {
+        return -1;
+    }
+    return resident;
+}
+
+static void *blocks[NBLOCKS];
+
+int main(int argc, char *argv[])
+{
+    long before, peak, after;
+
+    /* The decay interval is read on the first allocation. */
+    if (getenv("MM_DECAY_MS") == NULL) {
+        setenv("MM_DECAY_MS", "0", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    before = resident_pages();
+    for (int i = 0; i < NBLOCKS; i++) {
+        if ((blocks[i] = malloc(BLOCK_SIZE)) == NULL) {
+            return 1;
+        }
+        memset(blocks[i], 0xa5, BLOCK_SIZE);
+    }
+    peak = resident_pages();
+    for (int i = 0; i < NBLOCKS; i++) {
+        free(blocks[i]);
+    }
+    after = resident_pages();
+
+    if (before < 0 || peak < 0 || after < 0) {
+        return 2;
+    }
+    if (after - before > (peak - before) / 4) {
+        fprintf(stderr, "resident pages: before %ld, peak %ld, after %ld\n",
+                before, peak, after);
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../src/mm.h"
+
+#define NBLOCKS 2000
+#define BLOCK_SIZE 100
+#define MID_SIZE 40000
+#define ROUNDS 50
+
+static void *blocks[NBLOCKS];
+static int toConsumer[2];
+static int toProducer[2];
+
+/* This test checks that blocks freed by a thread of another arena make
+ * their way back to the allocating arena: a producer allocates a batch
+ * of messages, a consumer on a second arena frees them, and over many
+ * rounds the producer's pools must not grow.  Some of the messages are
+ * mid-size runs, which go back the same way. */
+static void *consumer(void *arg)
+{
+    char c;
+    // the first allocation assigns this thread the second arena
+    free(malloc(16));
+    while (read(toConsumer[0], &c, 1) == 1) {
+        for (int i = 0; i < NBLOCKS; i++) {
+            free(blocks[i]);
+        }
+        if (write(toProducer[1], &c, 1) != 1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    struct mm_stats first, last;
+    pthread_t thread;
+    char c = 0;
+
+    /* The arena count is read on the first allocation. */
+    if (getenv("MM_ARENAS") == NULL) {
+        setenv("MM_ARENAS", "2", 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    free(malloc(16));
+    if (pipe(toConsumer) != 0 || pipe(toProducer) != 0 ||
+        pthread_create(&thread, NULL, consumer, NULL) != 0) {
+        return 1;
+    }
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NBLOCKS; i++) {
+            size_t size = i % 100 == 0 ? MID_SIZE : BLOCK_SIZE;
+            blocks[i] = malloc(size);
+            if (blocks[i] == NULL) {
+                return 1;
+            }
+            memset(blocks[i], r, size);
+        }
+        if (write(toConsumer[1], &c, 1) != 1 || read(toProducer[0], &c, 1) != 1) {
+            return 1;
+        }
+        mm_stats(r == 0 ? &first : &last);
+    }
+    close(toConsumer[1]);
+    pthread_join(thread, NULL);
+
+    if (last.reserved_bytes > first.reserved_bytes) {
+        fprintf(stderr, "pools grew from %zu to %zu bytes\n",
+                first.reserved_bytes, last.reserved_bytes);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+void *aligned_alloc(size_t align, size_t size);
+void free_sized(void *ptr, size_t size);
+void free_aligned_sized(void *ptr, size_t align, size_t size);
+
+/* This test frees blocks of every pool size with free_sized() and
+ * checks that each lands in the right class: the next allocation of the
+ * same size must get it back.  It also covers blocks shrunk by realloc(),
+ * aligned blocks and bulk blocks.  Debug builds must abort when the size
+ * does not match the block. */
+int main(int argc, char *argv[])
+{
+    for (size_t size = 1; size <= 8192; size += size < 512 ? 1 : 37) {
+        char *p = malloc(size);
+        memset(p, 1, size);
+        uintptr_t freed = (uintptr_t)p;
+        free_sized(p, size);
+        p = malloc(size);
+        if (size <= 4000 && (uintptr_t)p != freed) {
+            fprintf(stderr, "block of size %zu not reused\n", size);
+            return 1;
+        }
+        free(p);
+    }
+
+    char *p = malloc(1000);
+    p = realloc(p, 900);
+    free_sized(p, 900);
+
+    for (size_t align = 16; align <= 8192; align *= 2) {
+        p = aligned_alloc(align, 300);
+        memset(p, 2, 300);
+        free_aligned_sized(p, align, 300);
+    }
+
+#ifdef MM_DEBUG
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(2);
+        p = malloc(100);
+        free_sized(p, 1000);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+        fprintf(stderr, "mismatched size not caught\n");
+        return 1;
+    }
+#endif
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "../src/mm.h"
+
+#define NBLOCKS 1000
+#define BLOCK_SIZE 100
+#define MID_SIZE 100000
+#define BULK_SIZE (4 << 20)
+
+static void *blocks[NBLOCKS];
+
+/* The class the BLOCK_SIZE-byte blocks went to: the smallest one at
+ * least that large, or the next one if the block header did not fit. */
+static int find_class(struct mm_stats *before, struct mm_stats *during)
+{
+    for (size_t i = 0; i + 1 < during->nclasses; i++) {
+        if (during->classes[i].size >= BLOCK_SIZE) {
+            return during->classes[i].live_blocks > before->classes[i].live_blocks ? i : i + 1;
+        }
+    }
+    return -1;
+}
+
+/* This test checks that the statistics follow a known sequence of
+ * allocations and frees, and that the dump triggered by the signal named
+ * in MM_STATS_SIGNAL reaches stderr. */
+int main(int argc, char *argv[])
+{
+    struct mm_stats before, during, after;
+
+    /* The signal handler is installed on the first allocation. */
+    if (getenv("MM_STATS_SIGNAL") == NULL) {
+        char sig[16];
+        snprintf(sig, sizeof(sig), "%d", SIGUSR1);
+        setenv("MM_STATS_SIGNAL", sig, 1);
+        execv("/proc/self/exe", argv);
+        return 1;
+    }
+
+    mm_stats(&before);
+    for (int i = 0; i < NBLOCKS; i++) {
+        blocks[i] = malloc(BLOCK_SIZE);
+    }
+    void *mid = malloc(MID_SIZE);
+    void *bulk = malloc(BULK_SIZE);
+    mm_stats(&during);
+    for (int i = 0; i < NBLOCKS; i++) {
+        free(blocks[i]);
+    }
+    free(mid);
+    free(bulk);
+    mm_stats(&after);
+
+    int c = find_class(&before, &during);
+    if (c < 0) {
+        return 1;
+    }
+    if (during.classes[c].live_blocks - before.classes[c].live_blocks != NBLOCKS ||
+        after.classes[c].live_blocks != before.classes[c].live_blocks) {
+        fprintf(stderr, "live blocks not tracked\n");
+        return 1;
+    }
+    if (during.classes[c].free_blocks + during.classes[c].live_blocks < NBLOCKS) {
+        fprintf(stderr, "run capacity not tracked\n");
+        return 1;
+    }
+    if (during.requested_bytes - before.requested_bytes != NBLOCKS * BLOCK_SIZE) {
+        fprintf(stderr, "requested bytes not tracked\n");
+        return 1;
+    }
+    if (during.mid_allocs - before.mid_allocs != 1 ||
+        during.mid_live_bytes - before.mid_live_bytes < MID_SIZE ||
+        after.mid_frees - before.mid_frees != 1 ||
+        after.mid_live_bytes != before.mid_live_bytes) {
+        fprintf(stderr, "mid-size allocations not tracked\n");
+        return 1;
+    }
+    if (during.bulk_allocs - before.bulk_allocs != 1 ||
+        during.bulk_live_bytes - before.bulk_live_bytes < BULK_SIZE ||
+        after.bulk_live_bytes != before.bulk_live_bytes) {
+        fprintf(stderr, "bulk allocations not tracked\n");
+        return 1;
+    }
+    if (during.reserved_bytes == 0 || during.mmap_calls == 0) {
+        fprintf(stderr, "mappings not tracked\n");
+        return 1;
+    }
+
+    /* Catch the dump on a pipe in place of stderr. */
+    int fds[2];
+    char buf[8192];
+    if (pipe(fds) != 0) {
+        return 1;
+    }
+    // nothing allocates between here and the dump
+    char expect[128];
+    mm_stats(&after);
+    snprintf(expect, sizeof(expect), "bulk: allocs %zu frees %zu live %zu",
+             after.bulk_allocs, after.bulk_frees, after.bulk_live_bytes);
+    int saved = dup(2);
+    dup2(fds[1], 2);
+    raise(SIGUSR1);
+    dup2(saved, 2);
+    close(fds[1]);
+    ssize_t n = read(fds[0], buf, sizeof(buf) - 1);
+    if (n <= 0) {
+        fprintf(stderr, "no statistics dump on signal\n");
+        return 1;
+    }
+    buf[n] = '\0';
+    if (strstr(buf, "pool:") == NULL || strstr(buf, expect) == NULL ||
+        strstr(buf, "class   size") == NULL) {
+        fprintf(stderr, "statistics dump incomplete\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#define NTHREADS 4
+#define NSLOTS 256
+#define ROUNDS 20000
+
+/* This test runs several threads that allocate, fill, check and free
+ * pool-sized blocks of random sizes at the same time.  Half of the
+ * blocks are handed to the next thread to free, so blocks allocated by
+ * one thread's cache end up in another's.  Any corruption of the
+ * shared pools shows up as a pattern mismatch or a crash. */
+static void *handoff[NTHREADS][NSLOTS];
+static pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int next_rand(unsigned int *state)
+{
+    *state = *state * 1103515245 + 12345;
+    return (*state >> 16) & 0x7fff;
+}
+
+static void *worker(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    unsigned int seed = id + 1;
+    unsigned char *slots[NSLOTS] = { NULL };
+    size_t sizes[NSLOTS] = { 0 };
+
+    for (int round = 0; round < ROUNDS; round++) {
+        int i = next_rand(&seed) % NSLOTS;
+        if (slots[i] != NULL) {
+            for (size_t j = 0; j < sizes[i]; j++) {
+                if (slots[i][j] != (unsigned char)(i + id)) {
+                    fprintf(stderr, "thread %d: block %d corrupted\n", id, i);
+                    exit(1);
+                }
+            }
+            if (round % 2) {
+                free(slots[i]);
+            } else {
+                /* Give the block to the next thread to free. */
+                pthread_mutex_lock(&handoff_lock);
+                void *old = handoff[(id + 1) % NTHREADS][i];
+                handoff[(id + 1) % NTHREADS][i] = slots[i];
+                pthread_mutex_unlock(&handoff_lock);
+                free(old);
+            }
+            slots[i] = NULL;
+        } else {
+            sizes[i] = 1 + next_rand(&seed) % 4000;
+            slots[i] = malloc(sizes[i]);
+            if (slots[i] == NULL) {
+                fprintf(stderr, "thread %d: malloc failed\n", id);
+                exit(1);
+            }
+            memset(slots[i], i + id, sizes[i]);
+        }
+    }
+    for (int i = 0; i < NSLOTS; i++) {
+        free(slots[i]);
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t threads[NTHREADS];
+
+    for (int i = 0; i < NTHREADS; i++) {
+        if (pthread_create(&threads[i], NULL, worker, (void *)(intptr_t)i)) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        for (int j = 0; j < NSLOTS; j++) {
+            free(handoff[i][j]);
+        }
+    }
+    return 0;
+}
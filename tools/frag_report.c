@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/size_classes.h"
+
+/*
+ * Reads allocation request sizes, one decimal number per line, from the
+ * files named on the command line (or stdin) and reports the internal
+ * fragmentation of the pool size classes: bytes requested against bytes
+ * reserved, per class and in total.  The same trace is also charged
+ * against the old power-of-two classes (32 to 4096 bytes) for
+ * comparison.  Requests larger than a pool block are not counted.
+ *
+ * Pass -n to model the headerless build, where pool blocks carry no
+ * 8-byte header.
+ */
+#define HEADER 8
+
+static size_t header = HEADER;
+
+/* The block size the power-of-two classes used for size bytes of data,
+ * or 0 if the request went to the bulk allocator. */
+static size_t pow2_block(size_t size)
+{
+    size_t block = 32;
+    while (block < size + header) {
+        block *= 2;
+    }
+    return block <= SIZE_CLASS_MAX ? block : 0;
+}
+
+static size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long count[NCLASSES] = { 0 };
+    unsigned long long requested[NCLASSES] = { 0 };
+    unsigned long long reserved[NCLASSES] = { 0 };
+    unsigned long long pow2_requested = 0, pow2_reserved = 0, bulk = 0;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        header = 0;
+        first = 2;
+    }
+
+    for (int arg = first; arg <= argc; arg++) {
+        FILE *in = stdin;
+        char line[64];
+
+        if (arg == argc && argc > first) {
+            break;
+        }
+        if (arg < argc && (in = fopen(argv[arg], "r")) == NULL) {
+            perror(argv[arg]);
+            return 1;
+        }
+        while (fgets(line, sizeof(line), in) != NULL) {
+            size_t size = strtoull(line, NULL, 10);
+            size_t need = align8(size) + header;
+            if (size == 0) {
+                continue;
+            }
+            if (need > SIZE_CLASS_MAX) {
+                bulk++;
+                continue;
+            }
+            int index = gSizeClass[need >> 3];
+            count[index]++;
+            requested[index] += size;
+            reserved[index] += gClassSize[index];
+            pow2_requested += size;
+            pow2_reserved += pow2_block(size);
+        }
+        if (in != stdin) {
+            fclose(in);
+        }
+    }
+
+    unsigned long long total_requested = 0, total_reserved = 0;
+    printf("%6s %12s %14s %14s %7s\n", "class", "blocks", "requested", "reserved", "waste");
+    for (int i = 0; i < NCLASSES; i++) {
+        if (count[i] == 0) {
+            continue;
+        }
+        printf("%6d %12llu %14llu %14llu %6.1f%%\n", gClassSize[i], count[i],
+               requested[i], reserved[i],
+               100.0 * (reserved[i] - requested[i]) / reserved[i]);
+        total_requested += requested[i];
+        total_reserved += reserved[i];
+    }
+    if (total_reserved == 0) {
+        printf("no pool-sized requests\n");
+        return 0;
+    }
+    printf("\n%-14s %14s %14s %7s\n", "scheme", "requested", "reserved", "waste");
+    printf("%-14s %14llu %14llu %6.1f%%\n", "size classes", total_requested,
+           total_reserved, 100.0 * (total_reserved - total_requested) / total_reserved);
+    printf("%-14s %14llu %14llu %6.1f%%\n", "power of two", pow2_requested,
+           pow2_reserved, 100.0 * (pow2_reserved - pow2_requested) / pow2_reserved);
+    printf("\n%llu requests too large for a pool block\n", bulk);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Prints src/size_classes.h from a size-class profile: the chunk size,
+ * the pool size classes, the number of chunks backing each class, and
+ * the table mapping a block size to its class.  The Makefile runs it on
+ * profiles/$(PROFILE).profile.
+ *
+ * A profile is a list of "NAME value" lines; # starts a comment and
+ * settings left out keep the defaults below.  Classes start at
+ * MIN_CLASS, step by 8 bytes up to LINEAR_MAX, and then take SPACING
+ * evenly spaced sizes per doubling up to MAX_CLASS, the largest pool
+ * block; larger requests go to the bulk allocator.  Each class is carved
+ * from runs of 1, 2, 4, ... up to MAX_CHUNKS chunks of 1 << CHUNK_SHIFT
+ * bytes, the smallest run that wastes at most 1/8 of its bytes.
+ */
+static struct {
+    const char *name;
+    long value;
+} settings[] = {
+    { "CHUNK_SHIFT", 12 },
+    { "MIN_CLASS", 16 },
+    { "LINEAR_MAX", 64 },
+    { "SPACING", 4 },
+    { "MAX_CLASS", 4096 },
+    { "MAX_CHUNKS", 8 },
+};
+
+enum { CHUNK_SHIFT, MIN_CLASS, LINEAR_MAX, SPACING, MAX_CLASS, MAX_CHUNKS, NSETTINGS };
+
+#define MAX_CLASSES 64
+
+static int is_pow2(long n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+static int read_profile(const char *path)
+{
+    char line[256], name[64];
+    long value;
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    for (int lineno = 1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+        if (sscanf(line, "%63s", name) != 1) {
+            continue;
+        }
+        int i = 0;
+        while (i < NSETTINGS && strcmp(settings[i].name, name) != 0) {
+            i++;
+        }
+        if (i == NSETTINGS || sscanf(line, "%*s %ld", &value) != 1) {
+            fprintf(stderr, "%s:%d: bad setting\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        settings[i].value = value;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Returns an error message if the geometry cannot work, or NULL. */
+static const char *check(void)
+{
+    long chunk = 1L << settings[CHUNK_SHIFT].value;
+
+    if (settings[CHUNK_SHIFT].value < 10 || settings[CHUNK_SHIFT].value > 16) {
+        return "CHUNK_SHIFT must be between 10 and 16";
+    }
+    if (settings[MIN_CLASS].value < 16 || settings[MIN_CLASS].value % 8) {
+        return "MIN_CLASS must be a multiple of 8, at least 16";
+    }
+    if (!is_pow2(settings[SPACING].value) ||
+        settings[LINEAR_MAX].value < 8 * settings[SPACING].value ||
+        !is_pow2(settings[LINEAR_MAX].value)) {
+        return "LINEAR_MAX must be a power of two, at least 8 * SPACING";
+    }
+    if (!is_pow2(settings[MAX_CHUNKS].value) || settings[MAX_CHUNKS].value > 128) {
+        return "MAX_CHUNKS must be a power of two, at most 128";
+    }
+    if (settings[MAX_CLASS].value % 8 || settings[MAX_CLASS].value < settings[MIN_CLASS].value ||
+        settings[MAX_CLASS].value > 32768 ||
+        settings[MAX_CLASS].value > chunk * settings[MAX_CHUNKS].value) {
+        return "MAX_CLASS must be a multiple of 8 that fits a run, at most 32768";
+    }
+    return NULL;
+}
+
+static void print_entry(int i, int per_line, long value)
+{
+    printf("%s%s%ld", i ? "," : "", i % per_line ? " " : "\n\t", value);
+}
+
+int main(int argc, char *argv[])
+{
+    long sizes[MAX_CLASSES + 1], pages[MAX_CLASSES + 1];
+    int nclasses = 0;
+    const char *error;
+
+    if (argc > 1 && read_profile(argv[1]) != 0) {
+        return 1;
+    }
+    if ((error = check()) != NULL) {
+        fprintf(stderr, "%s: %s\n", argc > 1 ? argv[1] : argv[0], error);
+        return 1;
+    }
+    long chunk = 1L << settings[CHUNK_SHIFT].value;
+    long max_class = settings[MAX_CLASS].value;
+
+    for (long size = settings[MIN_CLASS].value; size <= max_class && nclasses <= MAX_CLASSES; ) {
+        sizes[nclasses++] = size;
+        if (size < settings[LINEAR_MAX].value) {
+            size += 8;
+        } else {
+            long pow2 = 1;
+            while (pow2 * 2 <= size) {
+                pow2 *= 2;
+            }
+            size += pow2 / settings[SPACING].value;
+        }
+    }
+    if (nclasses <= MAX_CLASSES && sizes[nclasses - 1] != max_class) {
+        sizes[nclasses++] = max_class;
+    }
+    if (nclasses > MAX_CLASSES) {
+        fprintf(stderr, "more than %d size classes\n", MAX_CLASSES);
+        return 1;
+    }
+    for (int i = 0; i < nclasses; i++) {
+        pages[i] = 1;
+        while (pages[i] * chunk < sizes[i] ||
+               (pages[i] < settings[MAX_CHUNKS].value &&
+                (pages[i] * chunk) % sizes[i] * 8 > pages[i] * chunk)) {
+            pages[i] *= 2;
+        }
+        if (pages[i] * chunk / sizes[i] > 65535) {
+            fprintf(stderr, "too many blocks per run for class %ld\n", sizes[i]);
+            return 1;
+        }
+    }
+
+    printf("/* Generated by tools/gen_size_classes.c; do not edit. */\n");
+    printf("#ifndef SIZE_CLASSES_H\n#define SIZE_CLASSES_H\n\n");
+    printf("#define CHUNK_SHIFT %ld\n", settings[CHUNK_SHIFT].value);
+    printf("#define NCLASSES %d\n", nclasses);
+    printf("#define SIZE_CLASS_MAX %ld\n\n", max_class);
+    printf("#define UNUSED __attribute__((unused))\n\n");
+
+    printf("/* Block size of each class, header included. */\n");
+    printf("static const unsigned short gClassSize[NCLASSES] UNUSED = {");
+    for (int i = 0; i < nclasses; i++) {
+        print_entry(i, 8, sizes[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Chunks per run carved into blocks of each class. */\n");
+    printf("static const unsigned char gClassChunks[NCLASSES] UNUSED = {");
+    for (int i = 0; i < nclasses; i++) {
+        print_entry(i, 8, pages[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Blocks per run of each class. */\n");
+    printf("static const unsigned short gClassBlocks[NCLASSES] UNUSED = {");
+    for (int i = 0; i < nclasses; i++) {
+        print_entry(i, 8, pages[i] * chunk / sizes[i]);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Class of the smallest block of at least n bytes, indexed by\n");
+    printf(" * (n + 7) >> 3. */\n");
+    printf("static const unsigned char gSizeClass[(SIZE_CLASS_MAX >> 3) + 1] UNUSED = {");
+    for (long n = 0, i = 0; n <= max_class / 8; n++) {
+        while (sizes[i] < n * 8) {
+            i++;
+        }
+        print_entry(n, 16, i);
+    }
+    printf("\n};\n\n#undef UNUSED\n\n#endif\n");
+    return 0;
+}
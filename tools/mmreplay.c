@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mmtrace.h"
+
+/*
+ * Replays an allocation trace written by libmmtrace.so against whatever
+ * malloc the replayer runs with, and reports the time per call, the
+ * peak resident set and the fragmentation at the peak:
+ *
+ *   ./mmreplay [-t] trace
+ *   LD_PRELOAD=./libcsemalloc.so ./mmreplay [-t] trace
+ *
+ * The trace is loaded and turned into a list of operations on object
+ * IDs before the clock starts, so the replay itself does nothing but
+ * call the allocator and touch one byte per page of each new block.  By
+ * default every call is replayed on one thread in the original order;
+ * with -t each traced thread gets a thread of its own, and a call on an
+ * object allocated by another thread waits until that allocation has
+ * been replayed.
+ *
+ * Fragmentation is the growth of the peak resident set over the
+ * resident set before the replay, divided by the peak number of bytes
+ * the trace had live: 1.0 would mean no overhead at all.
+ */
+#define NONE UINT32_MAX
+#define PAGE 4096
+
+typedef struct Op {
+    uint8_t op;
+    uint8_t align;
+    uint32_t thread;
+    uint32_t id;        /* object allocated, or NONE */
+    uint32_t old;       /* object freed or resized, or NONE */
+    size_t size;
+} Op;
+
+typedef struct Replayer {
+    pthread_t tid;
+    Op **ops;
+    size_t count;
+} Replayer;
+
+static Op *gOps;
+static size_t gCount;
+static uint32_t gObjects;
+static void **gSlots;
+static size_t *gSizes;
+static size_t gLive;
+static size_t gPeakLive;
+static int gThreaded;
+static pthread_barrier_t gStart;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int by_seq(const void *a, const void *b)
+{
+    uint64_t x = ((const TraceRecord *)a)->seq;
+    uint64_t y = ((const TraceRecord *)b)->seq;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Open-addressing map from traced addresses to the IDs of the objects
+ * live at them.  A removed entry is left as a tombstone; the table has
+ * room for every record, so it never has to be rebuilt.
+ */
+#define TOMBSTONE 1
+
+typedef struct Entry {
+    uint64_t ptr;
+    uint32_t id;
+} Entry;
+
+static Entry *gMap;
+static size_t gMapMask;
+
+static size_t map_slot(uint64_t ptr)
+{
+    return (ptr >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & gMapMask;
+}
+
+static void map_put(uint64_t ptr, uint32_t id)
+{
+    size_t i = map_slot(ptr);
+    size_t free_slot = SIZE_MAX;
+    while (gMap[i].ptr != 0) {
+        if (gMap[i].ptr == ptr) {
+            // the address was reused without a free we saw
+            gMap[i].id = id;
+            return;
+        }
+        if (gMap[i].ptr == TOMBSTONE && free_slot == SIZE_MAX) {
+            free_slot = i;
+        }
+        i = (i + 1) & gMapMask;
+    }
+    if (free_slot != SIZE_MAX) {
+        i = free_slot;
+    }
+    gMap[i].ptr = ptr;
+    gMap[i].id = id;
+}
+
+static uint32_t map_take(uint64_t ptr)
+{
+    if (ptr == 0) {
+        return NONE;
+    }
+    for (size_t i = map_slot(ptr); gMap[i].ptr != 0; i = (i + 1) & gMapMask) {
+        if (gMap[i].ptr == ptr) {
+            gMap[i].ptr = TOMBSTONE;
+            return gMap[i].id;
+        }
+    }
+    return NONE;
+}
+
+/* Loads the trace at path into gOps.  Returns the number of threads in
+ * the trace, or -1 on error. */
+static int load(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(path);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(TraceHeader)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    const TraceHeader *header = (const TraceHeader *)map;
+    if (memcmp(header->magic, TRACE_MAGIC, 8) != 0 || header->version != 1
+        || header->record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a trace\n", path);
+        return -1;
+    }
+
+    size_t n = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    TraceRecord *records = malloc(n * sizeof(TraceRecord) + 1);
+    if (records == NULL) {
+        fprintf(stderr, "%s: out of memory for %zu records\n", path, n);
+        return -1;
+    }
+    memcpy(records, map + sizeof(TraceHeader), n * sizeof(TraceRecord));
+    munmap(map, st.st_size);
+    qsort(records, n, sizeof(TraceRecord), by_seq);
+
+    size_t capacity = 1024;
+    while (capacity < 2 * n) {
+        capacity *= 2;
+    }
+    gMap = calloc(capacity, sizeof(Entry));
+    gMapMask = capacity - 1;
+    gOps = malloc(n * sizeof(Op) + 1);
+    if (gMap == NULL || gOps == NULL) {
+        fprintf(stderr, "%s: out of memory for %zu records\n", path, n);
+        return -1;
+    }
+
+    uint32_t threads = 0;
+    for (size_t i = 0; i < n; i++) {
+        TraceRecord *r = &records[i];
+        Op *op = &gOps[gCount];
+        op->op = r->op;
+        op->align = r->align;
+        op->thread = r->thread;
+        op->size = r->size;
+        op->id = NONE;
+        op->old = NONE;
+        if (r->op == TRACE_FREE || r->op == TRACE_REALLOC) {
+            op->old = map_take(r->old);
+        }
+        if (r->op != TRACE_FREE && r->ptr != 0) {
+            op->id = gObjects++;
+            map_put(r->ptr, op->id);
+        }
+        if (op->id == NONE && op->old == NONE) {
+            // frees of memory allocated before tracing started
+            continue;
+        }
+        if (r->thread > threads) {
+            threads = r->thread;
+        }
+        gCount++;
+    }
+    free(records);
+    free(gMap);
+
+    gSlots = calloc(gObjects + 1, sizeof(void *));
+    gSizes = calloc(gObjects + 1, sizeof(size_t));
+    if (gSlots == NULL || gSizes == NULL) {
+        fprintf(stderr, "%s: out of memory for %u objects\n", path, gObjects);
+        return -1;
+    }
+    return threads;
+}
+
+static void live_add(size_t size)
+{
+    size_t live = __atomic_add_fetch(&gLive, size, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&gPeakLive, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&gPeakLive, &peak, live, 1,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Takes the block of object id, waiting for another thread to allocate
+ * it first if need be. */
+static void *take(uint32_t id)
+{
+    void *ptr;
+    while ((ptr = __atomic_exchange_n(&gSlots[id], NULL, __ATOMIC_ACQUIRE)) == NULL) {
+        if (!gThreaded) {
+            return NULL;
+        }
+        sched_yield();
+    }
+    __atomic_sub_fetch(&gLive, gSizes[id], __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void give(uint32_t id, void *ptr, size_t size, size_t from)
+{
+    for (size_t i = from; i < size; i += PAGE) {
+        ((volatile char *)ptr)[i] = 1;
+    }
+    gSizes[id] = size;
+    live_add(size);
+    __atomic_store_n(&gSlots[id], ptr, __ATOMIC_RELEASE);
+}
+
+static void replay(Op *op)
+{
+    void *ptr;
+    switch (op->op) {
+    case TRACE_MALLOC:
+        ptr = malloc(op->size);
+        break;
+    case TRACE_CALLOC:
+        ptr = calloc(1, op->size);
+        break;
+    case TRACE_MEMALIGN:
+        if (posix_memalign(&ptr, (size_t)1 << op->align, op->size) != 0) {
+            ptr = NULL;
+        }
+        break;
+    case TRACE_REALLOC: {
+        void *old = op->old != NONE ? take(op->old) : NULL;
+        size_t from = op->old != NONE ? gSizes[op->old] : 0;
+        ptr = realloc(old, op->size);
+        if (op->id != NONE && ptr != NULL) {
+            give(op->id, ptr, op->size, from);
+        } else if (op->id != NONE) {
+            fprintf(stderr, "mmreplay: reallocation to %zu bytes failed\n", op->size);
+            exit(1);
+        }
+        return;
+    }
+    case TRACE_FREE:
+        free(take(op->old));
+        return;
+    default:
+        return;
+    }
+    if (ptr == NULL) {
+        fprintf(stderr, "mmreplay: allocation of %zu bytes failed\n", op->size);
+        exit(1);
+    }
+    give(op->id, ptr, op->size, 0);
+}
+
+static void *replayer_main(void *arg)
+{
+    Replayer *r = arg;
+    pthread_barrier_wait(&gStart);
+    for (size_t i = 0; i < r->count; i++) {
+        replay(r->ops[i]);
+    }
+    return NULL;
+}
+
+/* Reads a field of /proc/self/status, in KB. */
+static long status_kb(const char *field)
+{
+    char line[256];
+    long kb = 0;
+    size_t len = strlen(field);
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = atol(line + len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+/* Resets the peak resident set to the current one, so that the peak
+ * does not count the memory used while loading the trace. */
+static void reset_peak(void)
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd >= 0) {
+        if (write(fd, "5", 1) != 1) {
+            fprintf(stderr, "mmreplay: cannot reset the peak RSS\n");
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            gThreaded = 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-t] trace\n", argv[0]);
+        return 1;
+    }
+    int threads = load(path);
+    if (threads < 0) {
+        return 1;
+    }
+    if (!gThreaded || threads == 0) {
+        threads = 1;
+    }
+
+    // one list of operations per replaying thread, in trace order
+    Replayer *replayers = calloc(threads, sizeof(Replayer));
+    Op **lists = malloc(gCount * sizeof(Op *) + 1);
+    size_t *counts = calloc(threads, sizeof(size_t));
+    if (replayers == NULL || lists == NULL || counts == NULL) {
+        fprintf(stderr, "out of memory for %d threads\n", threads);
+        return 1;
+    }
+    for (size_t i = 0; i < gCount; i++) {
+        counts[gThreaded ? gOps[i].thread - 1 : 0]++;
+    }
+    for (int t = 0, used = 0; t < threads; used += counts[t++]) {
+        replayers[t].ops = lists + used;
+    }
+    for (size_t i = 0; i < gCount; i++) {
+        Replayer *r = &replayers[gThreaded ? gOps[i].thread - 1 : 0];
+        r->ops[r->count++] = &gOps[i];
+    }
+
+    reset_peak();
+    long baseline = status_kb("VmRSS");
+    pthread_barrier_init(&gStart, NULL, threads + 1);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&replayers[t].tid, NULL, replayer_main, &replayers[t]);
+    }
+    pthread_barrier_wait(&gStart);
+    double start = now_ns();
+    for (int t = 0; t < threads; t++) {
+        pthread_join(replayers[t].tid, NULL);
+    }
+    double elapsed = now_ns() - start;
+
+    long peak = status_kb("VmHWM");
+    long growth = peak > baseline ? peak - baseline : 0;
+    printf("%zu calls on %d thread%s, %u objects\n", gCount, threads,
+           threads == 1 ? "" : "s", gObjects);
+    printf("time           %10.1f ns/op\n", gCount ? elapsed / gCount : 0.0);
+    printf("peak live      %10zu KB\n", gPeakLive / 1024);
+    printf("peak RSS       %10ld KB (%ld KB over baseline)\n", peak, growth);
+    if (gPeakLive > 0) {
+        printf("fragmentation  %10.2f\n", growth * 1024.0 / gPeakLive);
+    }
+    return 0;
+}
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "mmtrace.h"
+
+/*
+ * LD_PRELOAD tracer for the allocation calls.  Each call is forwarded to
+ * the next allocator in the search order (glibc, or libcsemalloc.so when
+ * it is preloaded after this library) and logged to the file named by
+ * MMTRACE_FILE (default mmtrace.<pid>):
+ *
+ *   LD_PRELOAD=./libmmtrace.so command
+ *   LD_PRELOAD="./libmmtrace.so ./libcsemalloc.so" command
+ *
+ * Records are kept in a buffer per thread, mapped with mmap() so that
+ * the tracer never allocates through the calls it traces, and appended
+ * to the file whenever a buffer fills, when its thread exits and at
+ * process exit.  A forked child drops the records it inherited, which
+ * the parent still writes, and traces to a file of its own:
+ * <MMTRACE_FILE>.<pid>, or mmtrace.<pid>.
+ */
+#define TRACE_BUFFER 4096
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    pthread_mutex_t lock;
+    uint32_t thread;
+    uint32_t count;
+    TraceRecord records[TRACE_BUFFER];
+} TraceBuffer;
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+static int gTraceFd = -1;
+static const char *gTraceName;
+static uint64_t gTraceSeq;
+static uint32_t gTraceThreads;
+static TraceBuffer *gTraceBuffers;
+static pthread_key_t gTraceKey;
+static __thread TraceBuffer *gBuffer;
+static __thread int gInTrace;
+
+/* dlsym() may allocate before the real functions are known; those
+ * requests are served from here and never freed. */
+static char gBootstrap[65536] __attribute__((aligned(16)));
+static size_t gBootstrapUsed;
+
+static void *bootstrap_alloc(size_t size)
+{
+    size_t offset = __atomic_fetch_add(&gBootstrapUsed, (size + 15) & ~(size_t)15,
+                                       __ATOMIC_RELAXED);
+    if (offset + size > sizeof(gBootstrap)) {
+        return NULL;
+    }
+    return gBootstrap + offset;
+}
+
+/* Bootstrap memory for the aligned calls, align a power of two. */
+static void *bootstrap_memalign(size_t align, size_t size)
+{
+    if (align <= 16) {
+        return bootstrap_alloc(size);
+    }
+    char *ptr = bootstrap_alloc(size + align);
+    if (ptr == NULL) {
+        return NULL;
+    }
+    return (void *)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+}
+
+static int is_bootstrap(void *ptr)
+{
+    return (char *)ptr >= gBootstrap && (char *)ptr < gBootstrap + sizeof(gBootstrap);
+}
+
+static void buffer_flush(TraceBuffer *buf)
+{
+    size_t len = buf->count * sizeof(TraceRecord);
+    char *p = (char *)buf->records;
+    while (len > 0 && gTraceFd >= 0) {
+        ssize_t n = write(gTraceFd, p, len);
+        if (n <= 0) {
+            break;
+        }
+        p += n;
+        len -= n;
+    }
+    buf->count = 0;
+}
+
+static void buffer_release(void *arg)
+{
+    TraceBuffer *buf = arg;
+    pthread_mutex_lock(&buf->lock);
+    buffer_flush(buf);
+    pthread_mutex_unlock(&buf->lock);
+}
+
+/* Writes "<base>.<pid>" to path without stdio, which may allocate and
+ * is not safe in a forked child.  Returns path, or NULL if it does not
+ * fit. */
+static const char *trace_path(char *path, size_t size, const char *base)
+{
+    char digits[16];
+    int n = 0;
+    size_t len = strlen(base);
+    for (pid_t pid = getpid(); pid > 0; pid /= 10) {
+        digits[n++] = '0' + pid % 10;
+    }
+    if (len + 1 + n + 1 > size) {
+        return NULL;
+    }
+    memcpy(path, base, len);
+    path[len++] = '.';
+    while (n > 0) {
+        path[len++] = digits[--n];
+    }
+    path[len] = '\0';
+    return path;
+}
+
+/* Opens the trace at name and writes its header, leaving gTraceFd at -1
+ * if either fails. */
+static void trace_open(const char *name)
+{
+    if (name == NULL) {
+        return;
+    }
+    gTraceFd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (gTraceFd >= 0) {
+        TraceHeader header = { TRACE_MAGIC, 1, sizeof(TraceRecord) };
+        if (write(gTraceFd, &header, sizeof(header)) != sizeof(header)) {
+            close(gTraceFd);
+            gTraceFd = -1;
+        }
+    }
+}
+
+/* The child drops the records of every buffer it inherited, which the
+ * parent writes itself, and starts a trace of its own. */
+static void trace_fork_child(void)
+{
+    char path[4096];
+
+    gInTrace = 1;
+    for (TraceBuffer *buf = gTraceBuffers; buf != NULL; buf = buf->next) {
+        pthread_mutex_init(&buf->lock, NULL);
+        buf->count = 0;
+    }
+    if (gTraceFd >= 0) {
+        close(gTraceFd);
+        gTraceFd = -1;
+    }
+    trace_open(trace_path(path, sizeof(path), gTraceName != NULL ? gTraceName : "mmtrace"));
+    gInTrace = 0;
+}
+
+static void __attribute__((constructor)) trace_init(void)
+{
+    char path[64];
+    const char *name = getenv("MMTRACE_FILE");
+
+    gInTrace = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    pthread_key_create(&gTraceKey, buffer_release);
+    pthread_atfork(NULL, NULL, trace_fork_child);
+
+    gTraceName = name;
+    trace_open(name != NULL ? name : trace_path(path, sizeof(path), "mmtrace"));
+    gInTrace = 0;
+}
+
+static void __attribute__((destructor)) trace_fini(void)
+{
+    gInTrace = 1;
+    for (TraceBuffer *buf = __atomic_load_n(&gTraceBuffers, __ATOMIC_ACQUIRE);
+         buf != NULL; buf = buf->next) {
+        buffer_release(buf);
+    }
+}
+
+static TraceBuffer *buffer_get(void)
+{
+    if (gBuffer != NULL) {
+        return gBuffer;
+    }
+    TraceBuffer *buf = mmap(NULL, sizeof(TraceBuffer), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        return NULL;
+    }
+    pthread_mutex_init(&buf->lock, NULL);
+    buf->thread = __atomic_add_fetch(&gTraceThreads, 1, __ATOMIC_RELAXED);
+    buf->next = __atomic_load_n(&gTraceBuffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&gTraceBuffers, &buf->next, buf, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    pthread_setspecific(gTraceKey, buf);
+    gBuffer = buf;
+    return buf;
+}
+
+static void trace(int op, size_t size, int align, void *ptr, void *old)
+{
+    if (gInTrace || gTraceFd < 0) {
+        return;
+    }
+    gInTrace = 1;
+    TraceBuffer *buf = buffer_get();
+    if (buf != NULL) {
+        pthread_mutex_lock(&buf->lock);
+        TraceRecord *r = &buf->records[buf->count++];
+        r->seq = __atomic_fetch_add(&gTraceSeq, 1, __ATOMIC_RELAXED);
+        r->thread = buf->thread;
+        r->op = op;
+        r->align = align;
+        r->pad = 0;
+        r->size = size;
+        r->ptr = (uintptr_t)ptr;
+        r->old = (uintptr_t)old;
+        if (buf->count == TRACE_BUFFER) {
+            buffer_flush(buf);
+        }
+        pthread_mutex_unlock(&buf->lock);
+    }
+    gInTrace = 0;
+}
+
+void *malloc(size_t size)
+{
+    if (real_malloc == NULL) {
+        return bootstrap_alloc(size);
+    }
+    void *ptr = real_malloc(size);
+    if (ptr != NULL) {
+        trace(TRACE_MALLOC, size, 0, ptr, NULL);
+    }
+    return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (real_calloc == NULL) {
+        /* bootstrap memory is static, hence zero */
+        return nmemb * size / (nmemb ? nmemb : 1) == size ? bootstrap_alloc(nmemb * size) : NULL;
+    }
+    void *ptr = real_calloc(nmemb, size);
+    if (ptr != NULL) {
+        trace(TRACE_CALLOC, nmemb * size, 0, ptr, NULL);
+    }
+    return ptr;
+}
+
+void *realloc(void *old, size_t size)
+{
+    if (is_bootstrap(old) || real_realloc == NULL) {
+        void *ptr = malloc(size);
+        if (ptr != NULL && old != NULL) {
+            size_t room = gBootstrap + sizeof(gBootstrap) - (char *)old;
+            memcpy(ptr, old, size < room ? size : room);
+        }
+        return ptr;
+    }
+    void *ptr = real_realloc(old, size);
+    if (ptr != NULL || size == 0) {
+        trace(TRACE_REALLOC, size, 0, ptr, old);
+    }
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_bootstrap(ptr)) {
+        return;
+    }
+    trace(TRACE_FREE, 0, 0, NULL, ptr);
+    real_free(ptr);
+}
+
+static int align_log2(size_t align)
+{
+    return align ? __builtin_ctzl(align) : 0;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    if (real_posix_memalign == NULL) {
+        *memptr = bootstrap_memalign(align, size);
+        return *memptr != NULL ? 0 : ENOMEM;
+    }
+    int ret = real_posix_memalign(memptr, align, size);
+    if (ret == 0) {
+        trace(TRACE_MEMALIGN, size, align_log2(align), *memptr, NULL);
+    }
+    return ret;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    if (real_aligned_alloc == NULL) {
+        return bootstrap_memalign(align, size);
+    }
+    void *ptr = real_aligned_alloc(align, size);
+    if (ptr != NULL) {
+        trace(TRACE_MEMALIGN, size, align_log2(align), ptr, NULL);
+    }
+    return ptr;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    if (real_memalign == NULL) {
+        return bootstrap_memalign(align, size);
+    }
+    void *ptr = real_memalign(align, size);
+    if (ptr != NULL) {
+        trace(TRACE_MEMALIGN, size, align_log2(align), ptr, NULL);
+    }
+    return ptr;
+}
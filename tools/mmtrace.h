@@ -0,0 +1,41 @@
+#ifndef MMTRACE_H
+#define MMTRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary format of allocation traces written by libmmtrace.so and read
+ * by mmreplay.  A trace is a TraceHeader followed by TraceRecords.  Each
+ * thread buffers its own records and appends them in blocks, so records
+ * are grouped by thread in the file; seq gives the global order of the
+ * calls.  Pointers are the addresses the traced allocator returned;
+ * mmreplay turns them into object IDs when it loads the trace.
+ */
+#define TRACE_MAGIC "MMTRACE1"
+
+enum {
+    TRACE_MALLOC = 1,   /* ptr = malloc(size) */
+    TRACE_CALLOC,       /* ptr = calloc(1, size) */
+    TRACE_REALLOC,      /* ptr = realloc(old, size) */
+    TRACE_FREE,         /* free(old) */
+    TRACE_MEMALIGN,     /* ptr = aligned allocation of size at 1 << align */
+};
+
+typedef struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} TraceHeader;
+
+typedef struct TraceRecord {
+    uint64_t seq;
+    uint32_t thread;
+    uint8_t op;
+    uint8_t align;
+    uint16_t pad;
+    uint64_t size;
+    uint64_t ptr;
+    uint64_t old;
+} TraceRecord;
+
+#endif